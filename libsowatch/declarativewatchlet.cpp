@@ -173,14 +173,19 @@ bool DeclarativeWatchlet::handlesNotification(Notification *notification) const
 	return false;
 }
 
-void DeclarativeWatchlet::openNotification(Notification *notification)
+void DeclarativeWatchlet::openNotification(Notification *notification, int collapsed)
 {
 	if (_item) {
 		QVariant arg = QVariant::fromValue(notification);
+		QVariant count(collapsed);
 		QVariant result;
 		if (!QMetaObject::invokeMethod(_item, "openNotification",
 		                               Q_RETURN_ARG(QVariant, result),
-		                               Q_ARG(QVariant, arg))) {
+		                               Q_ARG(QVariant, arg), Q_ARG(QVariant, count)) &&
+		        // Older watchlets do not take the collapsed count.
+		        !QMetaObject::invokeMethod(_item, "openNotification",
+		                                   Q_RETURN_ARG(QVariant, result),
+		                                   Q_ARG(QVariant, arg))) {
 			qWarning() << "No openNotification method in QML root object";
 		}
 	}
@@ -32,7 +32,7 @@ public:
 	void setNotificationsModel(NotificationsModel *model);
 
 	bool handlesNotification(Notification *notification) const;
-	void openNotification(Notification *notification);
+	void openNotification(Notification *notification, int collapsed);
 
 private:
 	void setRootObject(QDeclarativeItem* item);
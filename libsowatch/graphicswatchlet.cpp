@@ -1,8 +1,11 @@
 #include <QtCore/QDebug>
 #include <QtCore/QEvent>
+#include <QtCore/QVarLengthArray>
 #include <QtGui/QPainter>
 
 #include "watch.h"
+#include "configkey.h"
+#include "watchdamage.h"
 #include "graphicswatchlet.h"
 
 using namespace sowatch;
@@ -10,10 +13,16 @@ using namespace sowatch;
 GraphicsWatchlet::GraphicsWatchlet(Watch* watch, const QString& id)
     : Watchlet(watch, id),
       _scene(0), _frameTimer(),
-      _fullUpdateMode(false), _damaged()
+      _fullUpdateMode(false), _damaged(), _waitingForWatch(false),
+      _diffNextFrame(false),
+      _settings(0), _maxFps(0), _maxBytesPerSecond(0), _byteBudget(0),
+      _waitingForBudget(false), _throttled(false), _throttledFrames(0),
+      _fpsFrames(0), _fps(0.0), _droppedFrames(0),
+      _renderTime(0), _transmitTime(0)
 {
 	_frameTimer.setSingleShot(true);
 	connect(&_frameTimer, SIGNAL(timeout()), SLOT(frameTimeout()));
+	connect(watch, SIGNAL(readyForFrame()), SLOT(watchReady()));
 }
 
 GraphicsWatchlet::~GraphicsWatchlet()
@@ -56,6 +65,68 @@ QRectF GraphicsWatchlet::sceneRect() const
 	}
 }
 
+int GraphicsWatchlet::maxFramesPerSecond() const
+{
+	return _maxFps;
+}
+
+void GraphicsWatchlet::setMaxFramesPerSecond(int fps)
+{
+	_maxFps = qMax(fps, 0);
+}
+
+int GraphicsWatchlet::maxBytesPerSecond() const
+{
+	return _maxBytesPerSecond;
+}
+
+void GraphicsWatchlet::setMaxBytesPerSecond(int bytes)
+{
+	_maxBytesPerSecond = qMax(bytes, 0);
+	// Start again with a full budget.
+	_budgetTimer.invalidate();
+}
+
+bool GraphicsWatchlet::isThrottled() const
+{
+	return _throttled;
+}
+
+void GraphicsWatchlet::setSettings(ConfigKey *settings)
+{
+	delete _settings;
+	_settings = settings->getSubkey(QString(), this);
+	connect(_settings, SIGNAL(subkeyChanged(QString)), SLOT(settingChanged(QString)));
+
+	setMaxFramesPerSecond(_settings->value("max-fps", 0).toInt());
+	setMaxBytesPerSecond(_settings->value("max-bytes-per-second", 0).toInt());
+}
+
+MonoConverter* GraphicsWatchlet::monoConverter()
+{
+	return &_monoConverter;
+}
+
+qreal GraphicsWatchlet::framesPerSecond() const
+{
+	return _fps;
+}
+
+uint GraphicsWatchlet::droppedFrames() const
+{
+	return _droppedFrames;
+}
+
+int GraphicsWatchlet::renderTime() const
+{
+	return _renderTime;
+}
+
+int GraphicsWatchlet::transmitTime() const
+{
+	return _transmitTime;
+}
+
 QRect GraphicsWatchlet::viewportRect() const
 {
 	if (_active) {
@@ -80,8 +151,16 @@ void GraphicsWatchlet::sceneChanged(const QList<QRectF> &rects)
 			}
 		}
 
-		// Start frame timer if we got new data
-		if (!_damaged.isEmpty() && !_frameTimer.isActive()) {
+		if (_damaged.isEmpty()) {
+			return;
+		}
+
+		if (_waitingForWatch || _waitingForBudget) {
+			// The pending frame will include this change, so the
+			// previous state of the scene will never be drawn.
+			_droppedFrames++;
+		} else if (!_frameTimer.isActive()) {
+			// Start frame timer if we got new data
 			_frameTimer.start(frameDelay);
 		}
 	}
@@ -93,25 +172,231 @@ void GraphicsWatchlet::frameTimeout()
 	if (!_active) return;
 
 	if (watch()->busy()) {
-		// Watch is busy, delay this frame.
-		_frameTimer.start(busyFrameDelay);
+		// Watch is busy; wait until it says it is ready for the next frame,
+		// but check again after the time it expects to be busy just in case.
+		if (!_waitingForWatch) {
+			_waitingForWatch = true;
+			_transmitTimer.start();
+		}
+		_frameTimer.start(qBound(busyFrameDelay, watch()->drainTime(),
+		                         maxBusyFrameDelay));
 		return;
 	}
 
+	if (_waitingForWatch) {
+		_waitingForWatch = false;
+		_transmitTime = (_transmitTime * 3 + _transmitTimer.elapsed()) / 4;
+	}
+
+	if (_damaged.isEmpty()) return;
+
 	const QVector<QRect> rects = _damaged.rects();
-	QPainter p(watch());
-	foreach(const QRect& r, rects) {
-		_scene->render(&p, r, r, Qt::IgnoreAspectRatio);
+	const int cost = frameCost(rects);
+	const int delay = budgetDelay(cost);
+	if (delay > 0) {
+		// Keep coalescing scene changes until the budget allows this frame.
+		_waitingForBudget = true;
+		_frameTimer.start(delay);
+		return;
+	}
+
+	setThrottled(_waitingForBudget);
+	if (_waitingForBudget) {
+		_waitingForBudget = false;
+		_throttledFrames++;
 	}
+
+	QElapsedTimer renderTimer;
+	renderTimer.start();
+
+	renderFrame(rects, _diffNextFrame);
+	_diffNextFrame = false;
 	_damaged = QRegion();
+
+	_lastFrameTimer.start();
+	if (_maxBytesPerSecond > 0) {
+		_byteBudget -= cost;
+	}
+
+	_renderTime = (_renderTime * 3 + renderTimer.elapsed()) / 4;
+
+	_fpsFrames++;
+	if (!_fpsTimer.isValid()) {
+		_fpsTimer.start();
+	} else if (_fpsTimer.elapsed() >= 1000) {
+		_fps = (_fpsFrames * 1000.0) / _fpsTimer.restart();
+		_fpsFrames = 0;
+	}
+}
+
+void GraphicsWatchlet::watchReady()
+{
+	if (_active && _waitingForWatch) {
+		// Draw the latest state of the scene right away.
+		_frameTimer.start(0);
+	}
+}
+
+void GraphicsWatchlet::settingChanged(const QString &key)
+{
+	if (key == "max-fps") {
+		setMaxFramesPerSecond(_settings->value(key, 0).toInt());
+	} else if (key == "max-bytes-per-second") {
+		setMaxBytesPerSecond(_settings->value(key, 0).toInt());
+	}
+}
+
+int GraphicsWatchlet::frameCost(const QVector<QRect>& rects) const
+{
+	const Watch *watch = this->watch();
+	int cost = 0;
+	if (watch->depth() == 1) {
+		// Monochrome watches are line addressed, so whole rows are sent.
+		// Rects are sorted by row, so each row is only counted once.
+		const int bytesPerLine = (watch->width() + 7) / 8;
+		int counted = -1;
+		foreach(const QRect& r, rects) {
+			const int top = qMax(r.top(), counted + 1);
+			if (top <= r.bottom()) {
+				cost += (r.bottom() - top + 1) * bytesPerLine;
+				counted = r.bottom();
+			}
+		}
+	} else {
+		foreach(const QRect& r, rects) {
+			cost += r.width() * r.height();
+		}
+		cost = (cost * watch->depth() + 7) / 8;
+	}
+	return cost;
+}
+
+int GraphicsWatchlet::budgetDelay(int cost)
+{
+	int delay = 0;
+
+	if (_maxFps > 0 && _lastFrameTimer.isValid()) {
+		delay = qMax<int>(delay, 1000 / _maxFps - _lastFrameTimer.elapsed());
+	}
+
+	if (_maxBytesPerSecond > 0) {
+		if (!_budgetTimer.isValid()) {
+			_byteBudget = _maxBytesPerSecond;
+			_budgetTimer.start();
+		} else {
+			const qint64 refill = (_budgetTimer.elapsed() * _maxBytesPerSecond) / 1000;
+			if (refill > 0) {
+				_byteBudget = qMin<qint64>(_byteBudget + refill, _maxBytesPerSecond);
+				_budgetTimer.restart();
+			}
+		}
+
+		// A frame bigger than the whole budget is sent once the budget is
+		// full, and the following frames wait until it is paid back.
+		const int needed = qMin(cost, _maxBytesPerSecond);
+		if (_byteBudget < needed) {
+			const qint64 missing = needed - _byteBudget;
+			delay = qMax<int>(delay, (missing * 1000 + _maxBytesPerSecond - 1) / _maxBytesPerSecond);
+		}
+	}
+
+	return delay;
+}
+
+void GraphicsWatchlet::setThrottled(bool throttled)
+{
+	if (_throttled != throttled) {
+		_throttled = throttled;
+		if (_throttled) {
+			qDebug() << "watchlet" << _id << "throttled to" << _maxFps << "fps and"
+			         << _maxBytesPerSecond << "bytes/s";
+		}
+		emit throttledChanged();
+	}
+}
+
+void GraphicsWatchlet::renderFrame(const QVector<QRect>& rects, bool diff)
+{
+	const Watch *watch = this->watch();
+	const QSize size(watch->width(), watch->height());
+	if (_backBuffer.size() != size) {
+		_backBuffer = QImage(size, QImage::Format_RGB32);
+		_backBuffer.fill(QColor(Qt::white).rgb());
+		_monoBuffer = watch->depth() == 1 ? MonoConverter::createMonoImage(size) : QImage();
+		diff = false;
+	}
+
+	// Shares the data until the backbuffer is painted on.
+	const QImage previous = diff ? _backBuffer : QImage();
+
+	// Draw the scene into the backbuffer, which is retained as the last
+	// frame seen on the watch.
+	QPainter bp(&_backBuffer);
+	foreach(const QRect& r, rects) {
+		_scene->render(&bp, r, r, Qt::IgnoreAspectRatio);
+	}
+	bp.end();
+
+	const QVector<QRect> changed = diff ?
+	            (changedRegion(previous, _backBuffer, _damaged.boundingRect()) & _damaged).rects() :
+	            rects;
+	if (changed.isEmpty()) return;
+
+	if (watch->depth() == 1) {
+		// Qt's raster engine does a poor job when painting directly on mono
+		// images, which is why the scene is drawn in color first.
+		// Convert whole rows, since dithering patterns depend on them anyway.
+		// Rects are sorted by row, so each row is only converted once.
+		int converted = -1;
+		foreach(const QRect& r, changed) {
+			const int top = qMax(r.top(), converted + 1);
+			if (top <= r.bottom()) {
+				_monoConverter.convert(_backBuffer, &_monoBuffer, top, r.bottom() - top + 1);
+				converted = r.bottom();
+			}
+		}
+	}
+
+	const QImage& frame = watch->depth() == 1 ? _monoBuffer : _backBuffer;
+	QPainter p(this->watch());
+	p.setCompositionMode(QPainter::CompositionMode_Source);
+	foreach(const QRect& r, changed) {
+		p.drawImage(r, frame, r);
+	}
+}
+
+QRegion GraphicsWatchlet::changedRegion(const QImage& before, const QImage& after, const QRect& area)
+{
+	const int rows = area.height();
+	QVarLengthArray<int, 128> minX(rows), maxX(rows);
+	for (int i = 0; i < rows; i++) {
+		const QRgb *a = reinterpret_cast<const QRgb*>(before.constScanLine(area.top() + i));
+		const QRgb *b = reinterpret_cast<const QRgb*>(after.constScanLine(area.top() + i));
+		int x0 = area.left(), x1 = area.right();
+		while (x0 <= x1 && a[x0] == b[x0]) x0++;
+		while (x1 >= x0 && a[x1] == b[x1]) x1--;
+		minX[i] = x0;
+		maxX[i] = x1;
+	}
+	return DamageAccumulator::regionFromSpans(area.top(), minX.constData(), maxX.constData(), rows);
 }
 
 void GraphicsWatchlet::activate()
 {
 	Watchlet::activate();
-	// We have to assume that the watch has completely forgot about everything
-	// So assume the entire viewport is damaged
 	QRect viewport = viewportRect();
+	if (_backBuffer.size() == viewport.size()) {
+		// Show the last frame we drew right away; if the watch still has it,
+		// the driver will not even need to send it.
+		const QImage& frame = watch()->depth() == 1 ? _monoBuffer : _backBuffer;
+		QPainter p(watch());
+		p.setCompositionMode(QPainter::CompositionMode_Source);
+		p.drawImage(0, 0, frame);
+		// Then render the scene again, but only send what changed since.
+		_diffNextFrame = true;
+	}
+	// We have to assume that the scene changed while we were not active,
+	// so assume the entire viewport is damaged
 	_damaged += viewport;
 	// This will emit sceneChanged and start the frame timer.
 	_scene->update(viewport);
@@ -122,6 +407,16 @@ void GraphicsWatchlet::deactivate()
 	// Stop updates
 	_frameTimer.stop();
 	_damaged = QRegion();
+	_waitingForWatch = false;
+	_waitingForBudget = false;
+
+	qDebug() << "watchlet" << _id << "drew at" << _fps << "fps, dropped"
+	         << _droppedFrames << "frames, render" << _renderTime
+	         << "ms, transmit" << _transmitTime << "ms, throttled"
+	         << _throttledFrames << "frames";
+	_fpsTimer.invalidate();
+	_fpsFrames = 0;
+	setThrottled(false);
 
 	Watchlet::deactivate();
 }
@@ -2,18 +2,25 @@
 #define SOWATCH_GRAPHICSWATCHLET_H
 
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QGraphicsScene>
 #include <QRegion>
 #include "watchlet.h"
+#include "monoconverter.h"
 #include "sowatch_global.h"
 
 namespace sowatch
 {
 
+class ConfigKey;
+
 class SOWATCH_EXPORT GraphicsWatchlet : public Watchlet
 {
     Q_OBJECT
 	Q_PROPERTY(bool fullUpdateMode READ fullUpdateMode WRITE setFullUpdateMode)
+	Q_PROPERTY(int maxFramesPerSecond READ maxFramesPerSecond WRITE setMaxFramesPerSecond)
+	Q_PROPERTY(int maxBytesPerSecond READ maxBytesPerSecond WRITE setMaxBytesPerSecond)
+	Q_PROPERTY(bool throttled READ isThrottled NOTIFY throttledChanged)
 
 public:
 	explicit GraphicsWatchlet(Watch* watch, const QString& id);
@@ -28,12 +35,47 @@ public:
 	QRectF sceneRect() const;
 	QRect viewportRect() const;
 
+	/** Limits how often frames are sent to the watch; 0 means no limit. */
+	int maxFramesPerSecond() const;
+	void setMaxFramesPerSecond(int fps);
+	/** Limits the (estimated) amount of frame data sent to the watch
+	 *  per second; 0 means no limit. */
+	int maxBytesPerSecond() const;
+	void setMaxBytesPerSecond(int bytes);
+	/** Whether the last frame had to be delayed to stay within budget. */
+	bool isThrottled() const;
+
+	/** Reads the render budget from the watchlet's settings
+	 *  ("max-fps" and "max-bytes-per-second") and follows changes. */
+	void setSettings(ConfigKey *settings);
+
+	/** Settings used to convert frames for monochrome (1bpp) watches. */
+	MonoConverter* monoConverter();
+
+	/** Frames sent to the watch per second, measured over the last second. */
+	qreal framesPerSecond() const;
+	/** Scene changes that were never drawn because a newer one came
+	 *  while waiting for the watch or for the render budget. */
+	uint droppedFrames() const;
+	/** Average time spent rendering a frame, in msecs. */
+	int renderTime() const;
+	/** Average time a frame had to wait for the previous one to be
+	 *  transmitted, in msecs. */
+	int transmitTime() const;
+
 	void activate();
 	void deactivate();
 
+signals:
+	void throttledChanged();
+
 protected:
+	/** Time to wait for more scene changes before drawing a frame. */
 	static const int frameDelay = 25;
+	/** Bounds for how long to wait for a busy watch before checking it
+	 *  again, in case it never signals readyForFrame(). */
 	static const int busyFrameDelay = 50;
+	static const int maxBusyFrameDelay = 1000;
 
 	QGraphicsScene* _scene;
 	QTimer _frameTimer;
@@ -41,10 +83,59 @@ protected:
 private slots:
 	void sceneChanged(const QList<QRectF>& region);
 	void frameTimeout();
+	void watchReady();
+	void settingChanged(const QString& key);
 
 private:
+	/** Estimates how many bytes the watch needs to receive to draw rects. */
+	int frameCost(const QVector<QRect>& rects) const;
+	/** Returns how long the next frame has to wait to stay within budget. */
+	int budgetDelay(int cost);
+	void setThrottled(bool throttled);
+
+	/** Renders the scene into the RGB32 backbuffer and then sends it
+	 *  (converted to 1bpp if needed) to the watch. If diff is set, only
+	 *  the parts that differ from the previous frame are sent. */
+	void renderFrame(const QVector<QRect>& rects, bool diff);
+	/** Finds, for every row of area, the span of pixels that differ. */
+	static QRegion changedRegion(const QImage& before, const QImage& after, const QRect& area);
+
 	bool _fullUpdateMode;
 	QRegion _damaged;
+	/** Whether a frame is ready to be drawn but the watch is busy. */
+	bool _waitingForWatch;
+	/** Whether the watch is showing the retained frame, so that the
+	 *  next frame only needs to send what changed in the meantime. */
+	bool _diffNextFrame;
+
+	// Render budget
+	ConfigKey *_settings;
+	int _maxFps;
+	int _maxBytesPerSecond;
+	/** Bytes that can be sent right now; refilled at _maxBytesPerSecond
+	 *  up to one second worth of data. */
+	int _byteBudget;
+	QElapsedTimer _budgetTimer;
+	QElapsedTimer _lastFrameTimer;
+	/** Whether a frame is ready to be drawn but over budget. */
+	bool _waitingForBudget;
+	bool _throttled;
+	uint _throttledFrames;
+
+	// Frame statistics
+	QElapsedTimer _fpsTimer;
+	int _fpsFrames;
+	qreal _fps;
+	uint _droppedFrames;
+	int _renderTime;
+	int _transmitTime;
+	QElapsedTimer _transmitTimer;
+
+	MonoConverter _monoConverter;
+	/** Last frame drawn, kept while the watchlet is inactive so that it
+	 *  can be shown again as soon as it is activated. */
+	QImage _backBuffer;
+	QImage _monoBuffer;
 };
 
 }
@@ -18,6 +18,8 @@ DEFINES += SOWATCH_LIBRARY
 SOURCES += \
     watchserver.cpp \
     watchpaintengine.cpp \
+    watchdamage.cpp \
+    monoconverter.cpp \
     watchlet.cpp \
     watch.cpp \
     graphicswatchlet.cpp \
@@ -35,11 +37,14 @@ SOURCES += \
     configkey.cpp \
     gconfkey.cpp \
     notificationsmodel.cpp \
+    notificationqueue.cpp \
     watchletsmodel.cpp
 
 HEADERS += \
     watchserver.h \
     watchpaintengine.h \
+    watchdamage.h \
+    monoconverter.h \
     watchlet.h \
     watch.h \
     sowatch.h \
@@ -59,6 +64,7 @@ HEADERS += \
     configkey.h \
     gconfkey.h \
     notificationsmodel.h \
+    notificationqueue.h \
     watchletsmodel.h
 
 TRANSLATIONS += libsowatch_en.ts libsowatch_es.ts
@@ -0,0 +1,303 @@
+#include <QtCore/QDebug>
+#include <QtCore/QVarLengthArray>
+#include <string.h>
+
+// Define SOWATCH_NO_SIMD to only build the portable code, e.g. to test it.
+#if defined(__SSE2__) && !defined(SOWATCH_NO_SIMD)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) && !defined(SOWATCH_NO_SIMD)
+#include <arm_neon.h>
+#endif
+
+#include "monoconverter.h"
+
+using namespace sowatch;
+
+/** 8x8 Bayer matrix, scaled to thresholds in the [0, 255] range. */
+static const uchar bayerThresholds[8][8] = {
+	{   2, 130,  34, 162,  10, 138,  42, 170 },
+	{ 194,  66, 226,  98, 202,  74, 234, 106 },
+	{  50, 178,  18, 146,  58, 186,  26, 154 },
+	{ 242, 114, 210,  82, 250, 122, 218,  90 },
+	{  14, 142,  46, 174,   6, 134,  38, 166 },
+	{ 206,  78, 238, 110, 198,  70, 230, 102 },
+	{  62, 190,  30, 158,  54, 182,  22, 150 },
+	{ 254, 126, 222,  94, 246, 118, 214,  86 }
+};
+
+/** Computes the luma of a row of pixels. */
+static inline void lumaRow(const QRgb *src, uchar *dst, int width)
+{
+	int x = 0;
+#if defined(__SSE2__) && !defined(SOWATCH_NO_SIMD)
+	const __m128i zero = _mm_setzero_si128();
+	// Weights for B, G, R, A; same order as the bytes of a QRgb in memory.
+	const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+	for (; x + 16 <= width; x += 16) {
+		__m128i luma[4];
+		for (int i = 0; i < 4; i++) {
+			const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x + i * 4]));
+			// Products for each pair of pixels: B*29+G*150 and R*77 for each one.
+			__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), weights);
+			__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), weights);
+			lo = _mm_srli_epi32(_mm_add_epi32(lo, _mm_srli_epi64(lo, 32)), 8);
+			hi = _mm_srli_epi32(_mm_add_epi32(hi, _mm_srli_epi64(hi, 32)), 8);
+			luma[i] = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+			                             _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+		const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(luma[0], luma[1]),
+		                                        _mm_packs_epi32(luma[2], luma[3]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[x]), packed);
+	}
+#elif defined(__ARM_NEON__) && !defined(SOWATCH_NO_SIMD)
+	const uint8x8_t wr = vdup_n_u8(77), wg = vdup_n_u8(150), wb = vdup_n_u8(29);
+	for (; x + 8 <= width; x += 8) {
+		// Deinterleaves into B, G, R and A.
+		const uint8x8x4_t px = vld4_u8(reinterpret_cast<const uint8_t*>(&src[x]));
+		uint16x8_t sum = vmull_u8(px.val[2], wr);
+		sum = vmlal_u8(sum, px.val[1], wg);
+		sum = vmlal_u8(sum, px.val[0], wb);
+		vst1_u8(&dst[x], vshrn_n_u16(sum, 8));
+	}
+#endif
+	for (; x < width; x++) {
+		dst[x] = MonoConverter::luma(src[x]);
+	}
+}
+
+/** Packs a row of luma values into MonoLSB bits, comparing each one with
+ *  the threshold at the same position in a repeating 8 pixel pattern. */
+static inline void packRow(const uchar *luma, const uchar *thresholds,
+                           uchar *dst, int width)
+{
+	const int full = width / 8;
+	int i = 0;
+#if defined(__SSE2__) && !defined(SOWATCH_NO_SIMD)
+	const __m128i t = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(thresholds));
+	const __m128i t16 = _mm_unpacklo_epi64(t, t);
+	for (; i + 2 <= full; i += 2) {
+		const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&luma[i * 8]));
+		// There is no unsigned byte comparison, so find where l >= t instead.
+		const __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(l, t16), l);
+		const int bits = ~_mm_movemask_epi8(ge);
+		dst[i] = bits & 0xFF;
+		dst[i + 1] = (bits >> 8) & 0xFF;
+	}
+#elif defined(__ARM_NEON__) && !defined(SOWATCH_NO_SIMD)
+	static const uint8_t bitValues[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	const uint8x8_t t = vld1_u8(thresholds);
+	const uint8x8_t b = vld1_u8(bitValues);
+	for (; i < full; i++) {
+		const uint8x8_t l = vld1_u8(&luma[i * 8]);
+		uint8x8_t bits = vand_u8(vclt_u8(l, t), b);
+		// Add up the eight bits into a single byte.
+		bits = vpadd_u8(bits, bits);
+		bits = vpadd_u8(bits, bits);
+		bits = vpadd_u8(bits, bits);
+		dst[i] = vget_lane_u8(bits, 0);
+	}
+#endif
+	for (; i < full; i++) {
+		const uchar *l = &luma[i * 8];
+		dst[i] = (l[0] < thresholds[0]) << 0 | (l[1] < thresholds[1]) << 1 |
+		         (l[2] < thresholds[2]) << 2 | (l[3] < thresholds[3]) << 3 |
+		         (l[4] < thresholds[4]) << 4 | (l[5] < thresholds[5]) << 5 |
+		         (l[6] < thresholds[6]) << 6 | (l[7] < thresholds[7]) << 7;
+	}
+	if (width % 8) {
+		uchar byte = 0;
+		for (int x = full * 8; x < width; x++) {
+			byte |= (luma[x] < thresholds[x % 8]) << (x % 8);
+		}
+		dst[full] = byte;
+	}
+}
+
+MonoConverter::MonoConverter(Method method, int threshold)
+	: _method(method), _threshold(qBound(0, threshold, 255))
+{
+}
+
+MonoConverter::Method MonoConverter::method() const
+{
+	return _method;
+}
+
+void MonoConverter::setMethod(Method method)
+{
+	_method = method;
+}
+
+int MonoConverter::threshold() const
+{
+	return _threshold;
+}
+
+void MonoConverter::setThreshold(int threshold)
+{
+	_threshold = qBound(0, threshold, 255);
+}
+
+QImage MonoConverter::createMonoImage(const QSize& size)
+{
+	QImage image(size, QImage::Format_MonoLSB);
+	image.setColor(0, QColor(Qt::white).rgb());
+	image.setColor(1, QColor(Qt::black).rgb());
+	image.fill(0);
+	return image;
+}
+
+QImage MonoConverter::convert(const QImage& src) const
+{
+	QImage dst = createMonoImage(src.size());
+	convert(src, &dst, 0, src.height());
+	return dst;
+}
+
+void MonoConverter::convert(const QImage& src, QImage *dst, int top, int rows) const
+{
+	Q_ASSERT(dst->format() == QImage::Format_MonoLSB);
+	Q_ASSERT(dst->size() == src.size());
+
+	if (src.format() != QImage::Format_RGB32 &&
+	        src.format() != QImage::Format_ARGB32 &&
+	        src.format() != QImage::Format_ARGB32_Premultiplied) {
+		qWarning() << "Cannot convert image format" << src.format() << "to mono";
+		return;
+	}
+
+	top = qMax(top, 0);
+	rows = qMin(rows, src.height() - top);
+	if (rows <= 0) return;
+
+	switch (_method) {
+	case Threshold:
+		convertThreshold(src, dst, top, rows);
+		break;
+	case OrderedDither:
+		convertOrdered(src, dst, top, rows);
+		break;
+	case FloydSteinbergDither:
+		convertFloydSteinberg(src, dst, top, rows);
+		break;
+	case AdaptiveThreshold:
+		convertAdaptive(src, dst, top, rows);
+		break;
+	}
+}
+
+int MonoConverter::histogramThreshold(const uint *histogram)
+{
+	quint64 total = 0, sum = 0;
+	for (int i = 0; i < 256; i++) {
+		total += histogram[i];
+		sum += quint64(i) * histogram[i];
+	}
+
+	// Otsu's method: find the split that maximizes the variance
+	// between the dark and the bright class.
+	quint64 darkCount = 0, darkSum = 0;
+	double bestVariance = -1.0;
+	int best = 128;
+	for (int i = 0; i < 255; i++) {
+		darkCount += histogram[i];
+		darkSum += quint64(i) * histogram[i];
+		if (darkCount == 0) continue;
+		const quint64 brightCount = total - darkCount;
+		if (brightCount == 0) break;
+
+		const double diff = double(darkSum) / darkCount - double(sum - darkSum) / brightCount;
+		const double variance = double(darkCount) * double(brightCount) * diff * diff;
+		if (variance > bestVariance) {
+			bestVariance = variance;
+			// Values up to i are dark.
+			best = i + 1;
+		}
+	}
+
+	return best;
+}
+
+void MonoConverter::convertThreshold(const QImage& src, QImage *dst, int top, int rows) const
+{
+	const int width = src.width();
+	QVarLengthArray<uchar, 128> luma(width);
+	uchar thresholds[8];
+
+	memset(thresholds, _threshold, sizeof(thresholds));
+
+	for (int y = top; y < top + rows; y++) {
+		lumaRow(reinterpret_cast<const QRgb*>(src.constScanLine(y)), luma.data(), width);
+		packRow(luma.constData(), thresholds, dst->scanLine(y), width);
+	}
+}
+
+void MonoConverter::convertOrdered(const QImage& src, QImage *dst, int top, int rows) const
+{
+	const int width = src.width();
+	QVarLengthArray<uchar, 128> luma(width);
+
+	for (int y = top; y < top + rows; y++) {
+		lumaRow(reinterpret_cast<const QRgb*>(src.constScanLine(y)), luma.data(), width);
+		packRow(luma.constData(), bayerThresholds[y % 8], dst->scanLine(y), width);
+	}
+}
+
+void MonoConverter::convertAdaptive(const QImage& src, QImage *dst, int top, int rows) const
+{
+	const int width = src.width();
+	QVarLengthArray<uchar, 128 * 128> luma(width * rows);
+	uint histogram[256];
+	uchar thresholds[8];
+
+	memset(histogram, 0, sizeof(histogram));
+
+	for (int y = 0; y < rows; y++) {
+		uchar *l = &luma[y * width];
+		lumaRow(reinterpret_cast<const QRgb*>(src.constScanLine(top + y)), l, width);
+		for (int x = 0; x < width; x++) {
+			histogram[l[x]]++;
+		}
+	}
+
+	memset(thresholds, histogramThreshold(histogram), sizeof(thresholds));
+
+	for (int y = 0; y < rows; y++) {
+		packRow(&luma[y * width], thresholds, dst->scanLine(top + y), width);
+	}
+}
+
+void MonoConverter::convertFloydSteinberg(const QImage& src, QImage *dst, int top, int rows) const
+{
+	const int width = src.width();
+	// Errors carried to the current and next rows, with a pixel of padding
+	// on each side so that the edges need no special casing.
+	QVarLengthArray<int, 260> errors(2 * (width + 2));
+	int *cur = errors.data();
+	int *next = cur + width + 2;
+	memset(cur, 0, (width + 2) * sizeof(int));
+
+	for (int y = top; y < top + rows; y++) {
+		const QRgb *line = reinterpret_cast<const QRgb*>(src.constScanLine(y));
+		uchar *out = dst->scanLine(y);
+		memset(next, 0, (width + 2) * sizeof(int));
+		memset(out, 0, (width + 7) / 8);
+
+		for (int x = 0; x < width; x++) {
+			const int value = luma(line[x]) + cur[x + 1] / 16;
+			int error;
+			if (value < _threshold) {
+				out[x / 8] |= 1 << (x % 8);
+				error = value;
+			} else {
+				error = value - 255;
+			}
+			cur[x + 2] += error * 7;
+			next[x] += error * 3;
+			next[x + 1] += error * 5;
+			next[x + 2] += error * 1;
+		}
+
+		qSwap(cur, next);
+	}
+}
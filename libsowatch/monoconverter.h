@@ -0,0 +1,68 @@
+#ifndef SOWATCH_MONOCONVERTER_H
+#define SOWATCH_MONOCONVERTER_H
+
+#include <QtGui/QImage>
+#include "sowatch_global.h"
+
+namespace sowatch
+{
+
+/** Converts RGB32 images into 1bpp MonoLSB images, where color index 0 is
+ *  white and 1 is black, as used by monochrome watch framebuffers. */
+class SOWATCH_EXPORT MonoConverter
+{
+public:
+	enum Method {
+		/** Pixels darker than the threshold become black. */
+		Threshold,
+		/** Ordered dithering with an 8x8 Bayer matrix; stable across
+		 *  partial updates, so it is good for animations. */
+		OrderedDither,
+		/** Floyd-Steinberg error diffusion; best for still images. */
+		FloydSteinbergDither,
+		/** Like Threshold, but the threshold is chosen from the histogram
+		 *  of the rows being converted; good for images of unknown
+		 *  brightness, such as maps. Best used on whole images. */
+		AdaptiveThreshold
+	};
+
+	explicit MonoConverter(Method method = Threshold, int threshold = 128);
+
+	Method method() const;
+	void setMethod(Method method);
+
+	int threshold() const;
+	void setThreshold(int threshold);
+
+	/** Creates an image that can be used as a conversion target. */
+	static QImage createMonoImage(const QSize& size);
+
+	/** Converts the whole image. */
+	QImage convert(const QImage& src) const;
+	/** Converts some rows of src (RGB32 or ARGB32) into a mono image
+	 *  of the same size. */
+	void convert(const QImage& src, QImage *dst, int top, int rows) const;
+
+	/** Finds the threshold that best splits a histogram of 256 luma values
+	 *  into dark and bright pixels (Otsu's method). */
+	static int histogramThreshold(const uint *histogram);
+
+	/** Integer approximation of the ITU-R BT.601 luma of a color. */
+	static inline int luma(QRgb rgb)
+	{
+		return (qRed(rgb) * 77 + qGreen(rgb) * 150 + qBlue(rgb) * 29) >> 8;
+	}
+
+private:
+	void convertThreshold(const QImage& src, QImage *dst, int top, int rows) const;
+	void convertOrdered(const QImage& src, QImage *dst, int top, int rows) const;
+	void convertFloydSteinberg(const QImage& src, QImage *dst, int top, int rows) const;
+	void convertAdaptive(const QImage& src, QImage *dst, int top, int rows) const;
+
+	Method _method;
+	int _threshold;
+};
+
+}
+
+#endif // SOWATCH_MONOCONVERTER_H
@@ -0,0 +1,238 @@
+#include "notificationqueue.h"
+
+using namespace sowatch;
+
+NotificationQueue::NotificationQueue()
+	: _nextSeq(0), _frontSeq(-1), _taken(0),
+	  _duplicates(0), _expired(0), _collapsed(0)
+{
+	for (int i = 0; i < Notification::TypeCount; i++) {
+		_typeCount[i] = 0;
+	}
+}
+
+bool NotificationQueue::isEmpty() const
+{
+	return _queued.isEmpty();
+}
+
+int NotificationQueue::size() const
+{
+	return _queued.size();
+}
+
+bool NotificationQueue::contains(Notification *n) const
+{
+	return _queued.contains(n);
+}
+
+bool NotificationQueue::enqueue(Notification *n)
+{
+	const qint64 seq = _nextSeq++;
+	return insert(n, seq, seq, QDateTime::currentDateTime());
+}
+
+bool NotificationQueue::requeue(Notification *n)
+{
+	if (n == _taken) {
+		return insert(n, _frontSeq--, _takenInfo.order, _takenInfo.queued);
+	} else {
+		return insert(n, _frontSeq--, _nextSeq++, QDateTime::currentDateTime());
+	}
+}
+
+bool NotificationQueue::remove(Notification *n)
+{
+	if (n == _taken) {
+		_taken = 0;
+	}
+
+	QHash<Notification*, Info>::iterator it = _queued.find(n);
+	if (it == _queued.end()) return false;
+
+	// The heap entry is skipped once it reaches the top.
+	_typeCount[it->type]--;
+	_queued.erase(it);
+	compact();
+	return true;
+}
+
+void NotificationQueue::clear()
+{
+	_heap.clear();
+	_queued.clear();
+	_taken = 0;
+	for (int i = 0; i < Notification::TypeCount; i++) {
+		_typeCount[i] = 0;
+	}
+}
+
+Notification * NotificationQueue::take(const QDateTime& expiry, int *collapsed)
+{
+	if (collapsed) *collapsed = 0;
+	_taken = 0;
+
+	if (!peek(expiry)) {
+		return 0;
+	}
+
+	const Entry top = _heap.first();
+	pop();
+
+	QHash<Notification*, Info>::iterator it = _queued.find(top.n);
+	const Info info = it.value();
+	_typeCount[info.type]--;
+	_queued.erase(it);
+
+	Notification *result = top.n;
+	Info resultInfo = info;
+	int merged = 0;
+
+	if (_typeCount[info.type] > 0) {
+		it = _queued.begin();
+		while (it != _queued.end()) {
+			if (it->type != info.type) {
+				++it;
+				continue;
+			}
+			if (it->queued < expiry) {
+				_expired++;
+			} else {
+				merged++;
+				// Lower priority ones collapse into the result, but never
+				// the other way around; among equals, the newest wins.
+				if (it->priority > resultInfo.priority ||
+				        (it->priority == resultInfo.priority &&
+				         it->order > resultInfo.order)) {
+					resultInfo = it.value();
+					result = it.key();
+				}
+			}
+			it = _queued.erase(it);
+		}
+		_typeCount[info.type] = 0;
+		compact();
+	}
+
+	_collapsed += merged;
+	if (collapsed) *collapsed = merged;
+	_taken = result;
+	_takenInfo = resultInfo;
+	return result;
+}
+
+Notification * NotificationQueue::peek(const QDateTime& expiry)
+{
+	while (!_heap.isEmpty()) {
+		const Entry top = _heap.first();
+
+		QHash<Notification*, Info>::iterator it = _queued.find(top.n);
+		if (it == _queued.end() || it->seq != top.seq) {
+			pop();
+			continue; // Removed or requeued since
+		}
+
+		if (it->queued < expiry) {
+			_expired++;
+			_typeCount[it->type]--;
+			_queued.erase(it);
+			pop();
+			continue;
+		}
+
+		return top.n;
+	}
+
+	return 0;
+}
+
+uint NotificationQueue::duplicates() const
+{
+	return _duplicates;
+}
+
+uint NotificationQueue::expired() const
+{
+	return _expired;
+}
+
+uint NotificationQueue::collapsed() const
+{
+	return _collapsed;
+}
+
+bool NotificationQueue::insert(Notification *n, qint64 seq, qint64 order, const QDateTime& queued)
+{
+	if (_queued.contains(n)) {
+		_duplicates++;
+		return false;
+	}
+
+	const Info info = { n->priority(), seq, order, n->type(), queued };
+	const Entry entry = { info.priority, seq, n };
+	_queued.insert(n, info);
+	_typeCount[info.type]++;
+	_heap.append(entry);
+	siftUp(_heap.size() - 1);
+	return true;
+}
+
+void NotificationQueue::compact()
+{
+	// Rebuild the heap once most of its entries are stale.
+	if (_heap.size() <= 2 * _queued.size() + 16) return;
+
+	_heap.clear();
+	QHash<Notification*, Info>::const_iterator it;
+	for (it = _queued.constBegin(); it != _queued.constEnd(); ++it) {
+		const Entry entry = { it->priority, it->seq, it.key() };
+		_heap.append(entry);
+	}
+	for (int i = _heap.size() / 2 - 1; i >= 0; i--) {
+		siftDown(i);
+	}
+}
+
+bool NotificationQueue::before(const Entry& a, const Entry& b)
+{
+	if (a.priority != b.priority) {
+		return a.priority > b.priority;
+	}
+	return a.seq < b.seq;
+}
+
+void NotificationQueue::siftUp(int i)
+{
+	Entry *heap = _heap.data();
+	while (i > 0) {
+		const int parent = (i - 1) / 2;
+		if (!before(heap[i], heap[parent])) break;
+		qSwap(heap[i], heap[parent]);
+		i = parent;
+	}
+}
+
+void NotificationQueue::siftDown(int i)
+{
+	Entry *heap = _heap.data();
+	const int size = _heap.size();
+	forever {
+		int first = i;
+		const int left = 2 * i + 1;
+		const int right = left + 1;
+		if (left < size && before(heap[left], heap[first])) first = left;
+		if (right < size && before(heap[right], heap[first])) first = right;
+		if (first == i) break;
+		qSwap(heap[i], heap[first]);
+		i = first;
+	}
+}
+
+void NotificationQueue::pop()
+{
+	_heap.first() = _heap.last();
+	_heap.resize(_heap.size() - 1);
+	if (!_heap.isEmpty()) {
+		siftDown(0);
+	}
+}
@@ -0,0 +1,101 @@
+#ifndef SOWATCH_NOTIFICATIONQUEUE_H
+#define SOWATCH_NOTIFICATIONQUEUE_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include "sowatch_global.h"
+#include "notification.h"
+
+namespace sowatch
+{
+
+/** Notifications waiting to be shown on the watch, most important first:
+ *  Urgent ones go before Normal ones, and otherwise they are kept in the
+ *  order they were queued. A notification is queued at most once.
+ *  Notifications are never dereferenced after being queued, so they can be
+ *  removed even while being destroyed. */
+class SOWATCH_EXPORT NotificationQueue
+{
+public:
+	NotificationQueue();
+
+	bool isEmpty() const;
+	int size() const;
+	bool contains(Notification *n) const;
+
+	/** Queues a notification; returns false if it was already queued,
+	 *  in which case it keeps its place. */
+	bool enqueue(Notification *n);
+	/** Queues a notification ahead of all others of its priority,
+	 *  e.g. one that was being shown when an urgent one arrived.
+	 *  If it is the last one returned by take(), it keeps the time it was
+	 *  originally queued at, both for expiry and for collapsing. */
+	bool requeue(Notification *n);
+	/** Returns false if the notification was not queued. */
+	bool remove(Notification *n);
+	void clear();
+
+	/** Takes the next notification to show, skipping those queued before
+	 *  expiry. All other notifications of the same type that are queued are
+	 *  collapsed into it: they are removed, and the most recently queued
+	 *  of those with its priority is returned instead so that it can be
+	 *  shown as a summary; a notification is never collapsed into one of
+	 *  lower priority. The number of collapsed notifications is stored
+	 *  in collapsed. */
+	Notification * take(const QDateTime& expiry, int *collapsed = 0);
+	/** Returns the next notification to show without taking it, dropping
+	 *  those queued before expiry like take() does. take() returns either
+	 *  this one or another of the same type collapsed into it. */
+	Notification * peek(const QDateTime& expiry);
+
+	// Statistics since the queue was created
+	uint duplicates() const;
+	uint expired() const;
+	uint collapsed() const;
+
+private:
+	struct Entry {
+		int priority;
+		qint64 seq;
+		Notification *n;
+	};
+	struct Info {
+		int priority;
+		qint64 seq;
+		/** Order in which notifications were first queued; unlike seq,
+		 *  it does not change when a notification is requeued. */
+		qint64 order;
+		Notification::Type type;
+		QDateTime queued;
+	};
+
+	bool insert(Notification *n, qint64 seq, qint64 order, const QDateTime& queued);
+	void compact();
+	static bool before(const Entry& a, const Entry& b);
+	void siftUp(int i);
+	void siftDown(int i);
+	void pop();
+
+	/** Binary heap; entries whose seq does not match the one in _queued
+	 *  were removed and are skipped when they reach the top. */
+	QVector<Entry> _heap;
+	QHash<Notification*, Info> _queued;
+	/** Number of queued notifications of each type. */
+	int _typeCount[Notification::TypeCount];
+	qint64 _nextSeq;
+	qint64 _frontSeq;
+	/** The last notification returned by take(), so that requeue() can
+	 *  restore its place. */
+	Notification *_taken;
+	Info _takenInfo;
+
+	uint _duplicates;
+	uint _expired;
+	uint _collapsed;
+};
+
+}
+
+#endif // SOWATCH_NOTIFICATIONQUEUE_H
@@ -1,17 +1,31 @@
+#include <QtCore/QtAlgorithms>
+
 #include "notificationsmodel.h"
 
 using namespace sowatch;
 
-#define FOREACH_TYPE_FROM_TO(x, from, to) \
-	for(Notification::Type x = from; x < to; x = static_cast<Notification::Type>(x + 1))
+NotificationsModel::NotificationsModel(QObject *parent) :
+    QAbstractListModel(parent), _nextSeq(0), _generation(0), _fullCount(0),
+    _flushTimer(new QTimer(this))
+{
+	for (int i = 0; i <= Notification::TypeCount; i++) {
+		_offsets[i] = 0;
+	}
+	for (int i = 0; i < Notification::TypeCount; i++) {
+		_counts[i] = 0;
+		_fullCounts[i] = 0;
+		_flushedCounts[i] = 0;
+		_flushedFullCounts[i] = 0;
+	}
 
-#define FOREACH_TYPE_UNTIL(x, to) FOREACH_TYPE_FROM_TO(x, Notification::OtherNotification, to)
+	const ChangeSummary none = { 0, 0, 0 };
+	_pendingChanges = none;
+	_lastChanges = none;
 
-#define FOREACH_TYPE(x) FOREACH_TYPE_FROM_TO(x, Notification::OtherNotification, Notification::TypeCount)
+	_flushTimer->setSingleShot(true);
+	_flushTimer->setInterval(0);
+	connect(_flushTimer, SIGNAL(timeout()), SLOT(flushChanges()));
 
-NotificationsModel::NotificationsModel(QObject *parent) :
-    QAbstractListModel(parent)
-{
 #if QT_VERSION < QT_VERSION_CHECK(5,0,0)
     setRoleNames(roleNames());
 #endif
@@ -53,34 +67,26 @@ QVariant NotificationsModel::data(const QModelIndex &index, int role) const
 
 int NotificationsModel::size() const
 {
-	int count = 0;
-	FOREACH_TYPE(type) {
-		count += _list[type].count();
-	}
-	return count;
+	return _offsets[Notification::TypeCount];
 }
 
 int NotificationsModel::size(const QList<Notification::Type>& types) const
 {
-	int count = 0;
-	foreach(Notification::Type type, types) {
-		count += _list[type].count();
-	}
-	return count;
+	return view(types).size();
 }
 
 Notification * NotificationsModel::at(int position) const
 {
-	FOREACH_TYPE(type) {
-		const int size = _list[type].size();
-		if (position < size) {
-			return _list[type].at(position);
-		} else {
-			position -= size;
-		}
+	if (position < 0 || position >= size()) {
+		qWarning() << "Notification with index" << position << "not found";
+		return 0;
 	}
-	qWarning() << "Notification with index" << position << "not found";
-	return 0;
+
+	// Find the last type that starts at or before this row;
+	// it cannot be empty since position is below the start of the next one.
+	const int *next = qUpperBound(&_offsets[0], &_offsets[Notification::TypeCount + 1], position);
+	const int type = (next - &_offsets[0]) - 1;
+	return _list[type].at(position - _offsets[type]);
 }
 
 Notification * NotificationsModel::at(Notification::Type type, int position) const
@@ -96,16 +102,52 @@ Notification * NotificationsModel::at(Notification::Type type, int position) con
 
 Notification * NotificationsModel::at(const QList<Notification::Type>& types, int position) const
 {
-	foreach(Notification::Type type, types) {
-		const int size = _list[type].size();
-		if (position < size) {
-			return _list[type].at(position);
-		} else {
-			position -= size;
-		}
+	return view(types).at(position);
+}
+
+NotificationsModel::View NotificationsModel::view(const QList<Notification::Type>& types) const
+{
+	return View(this, types);
+}
+
+NotificationsModel::View::View(const NotificationsModel *model, const QList<Notification::Type>& types)
+	: _model(model), _types(types), _offsets(types.size() + 1),
+	  _generation(model->_generation + 1) // Forces update() to build the table
+{
+	update();
+}
+
+int NotificationsModel::View::size() const
+{
+	update();
+	return _offsets.last();
+}
+
+Notification * NotificationsModel::View::at(int position) const
+{
+	update();
+	if (position < 0 || position >= _offsets.last()) {
+		qWarning() << "Notification with index" << position << "not found";
+		return 0;
 	}
-	qWarning() << "Notification with index" << position << "not found";
-	return 0;
+
+	// Same as NotificationsModel::at(), over the types of the view.
+	const int *next = qUpperBound(_offsets.constBegin(), _offsets.constEnd(), position);
+	const int i = (next - _offsets.constBegin()) - 1;
+	return _model->_list[_types.at(i)].at(position - _offsets.at(i));
+}
+
+void NotificationsModel::View::update() const
+{
+	if (_generation == _model->_generation) return;
+
+	int offset = 0;
+	for (int i = 0; i < _types.size(); i++) {
+		_offsets[i] = offset;
+		offset += _model->_list[_types.at(i)].size();
+	}
+	_offsets[_types.size()] = offset;
+	_generation = _model->_generation;
 }
 
 void NotificationsModel::add(Notification *n)
@@ -114,10 +156,19 @@ void NotificationsModel::add(Notification *n)
 	const int offset = getAppendOffsetForType(type);
 
 	beginInsertRows(QModelIndex(), offset, offset);
+	Location location = { type, _nextSeq++, false, 0 };
+	updateCounts(n, &location);
 	_list[type].append(n);
+	_seqs[type].append(location.seq);
+	_locations.insert(n, location);
+	for (int t = type + 1; t <= Notification::TypeCount; t++) {
+		_offsets[t]++;
+	}
+	_generation++;
 	endInsertRows();
 
-	emit modelChanged();
+	_pendingChanges.added++;
+	scheduleFlush();
 
 	connect(n, SIGNAL(changed()), SLOT(handleNotificationChanged()));
 }
@@ -130,49 +181,50 @@ void NotificationsModel::remove(Notification *n)
 
 void NotificationsModel::remove(Notification::Type type, Notification *n)
 {
-	const int subindex = _list[type].indexOf(n);
-	const int index = getOffsetForType(type) + subindex;
+	QHash<Notification*, Location>::iterator it = _locations.find(n);
+	if (it == _locations.end()) {
+		qWarning() << "Removing unknown notification" << n;
+		return;
+	}
+	Q_ASSERT(it->type == type);
 
-	Q_ASSERT(index >= 0);
+	const int subindex = getSubindex(type, it->seq);
+	const int index = getOffsetForType(type) + subindex;
 
 	disconnect(n, 0, this, 0);
 
 	beginRemoveRows(QModelIndex(), index, index);
 	_list[type].removeAt(subindex);
+	_seqs[type].removeAt(subindex);
+	if (it->counted) {
+		_counts[type]--;
+		_fullCounts[type] -= it->count;
+		_fullCount -= it->count;
+	}
+	_locations.erase(it);
+	for (int t = type + 1; t <= Notification::TypeCount; t++) {
+		_offsets[t]--;
+	}
+	_generation++;
 	endRemoveRows();
 
-	emit modelChanged();
+	_pendingChanges.removed++;
+	scheduleFlush();
 }
 
 int NotificationsModel::countByType(Notification::Type type) const
 {
-	int count = 0;
-	Q_FOREACH(const Notification *n, _list[type]) {
-		if (n->priority() != Notification::Silent) {
-			count++;
-		}
-	}
-	return count;
+	return _counts[type];
 }
 
 int NotificationsModel::fullCount() const
 {
-	int count = 0;
-	FOREACH_TYPE(type) {
-		count += fullCountByType(type);
-	}
-	return count;
+	return _fullCount;
 }
 
 int NotificationsModel::fullCountByType(Notification::Type type) const
 {
-	int count = 0;
-	Q_FOREACH(const Notification *n, _list[type]) {
-		if (n->priority() != Notification::Silent) {
-			count += n->count();
-		}
-	}
-	return count;
+	return _fullCounts[type];
 }
 
 int NotificationsModel::fullCountByType(int type) const
@@ -200,36 +252,100 @@ QObject* NotificationsModel::getMostRecentByType(int type) const
 Notification::Type NotificationsModel::getTypeOfDeletedNotification(Notification *n) const
 {
 	// Can't call any methods of 'n'
-	FOREACH_TYPE(type) {
-		if (_list[type].contains(n)) {
-			return type;
-		}
+	QHash<Notification*, Location>::const_iterator it = _locations.constFind(n);
+	if (it != _locations.constEnd()) {
+		return it->type;
 	}
 	return Notification::OtherNotification;
 }
 
 int NotificationsModel::getOffsetForType(Notification::Type type) const
 {
-	int count = 0;
-	FOREACH_TYPE_UNTIL(t, type) {
-		count += _list[t].count();
-	}
-	return count;
+	return _offsets[type];
 }
 
 int NotificationsModel::getAppendOffsetForType(Notification::Type type) const
 {
-	return getOffsetForType(type) + _list[type].count();
+	return _offsets[type + 1];
 }
 
 int NotificationsModel::getIndexForNotification(Notification *n) const
 {
-	Notification::Type type = n->type();
-	const int subindex = _list[type].indexOf(n);
+	QHash<Notification*, Location>::const_iterator it = _locations.constFind(n);
+
+	Q_ASSERT(it != _locations.constEnd());
 
-	Q_ASSERT(subindex >= 0);
+	return _offsets[it->type] + getSubindex(it->type, it->seq);
+}
+
+int NotificationsModel::getSubindex(Notification::Type type, qint64 seq) const
+{
+	const QList<qint64>& seqs = _seqs[type];
+	QList<qint64>::const_iterator it = qLowerBound(seqs.constBegin(), seqs.constEnd(), seq);
 
-	return getOffsetForType(type) + subindex;
+	Q_ASSERT(it != seqs.constEnd() && *it == seq);
+
+	return it - seqs.constBegin();
+}
+
+NotificationsModel::ChangeSummary NotificationsModel::lastChanges() const
+{
+	return _lastChanges;
+}
+
+int NotificationsModel::batchInterval() const
+{
+	return _flushTimer->interval();
+}
+
+void NotificationsModel::setBatchInterval(int msec)
+{
+	_flushTimer->setInterval(qMax(msec, 0));
+}
+
+void NotificationsModel::flushChanges()
+{
+	_flushTimer->stop();
+
+	if (_pendingChanges.added == 0 && _pendingChanges.removed == 0 &&
+	        _pendingChanges.changed == 0) {
+		return;
+	}
+
+	_lastChanges = _pendingChanges;
+	_pendingChanges.added = 0;
+	_pendingChanges.removed = 0;
+	_pendingChanges.changed = 0;
+
+	for (int i = 0; i < Notification::TypeCount; i++) {
+		if (_counts[i] != _flushedCounts[i] || _fullCounts[i] != _flushedFullCounts[i]) {
+			_flushedCounts[i] = _counts[i];
+			_flushedFullCounts[i] = _fullCounts[i];
+			emit countsChanged(static_cast<Notification::Type>(i));
+		}
+	}
+
+	emit modelChanged();
+}
+
+void NotificationsModel::updateCounts(Notification *n, Location *location)
+{
+	const Notification::Type type = location->type;
+	const bool counted = n->priority() != Notification::Silent;
+	const uint count = counted ? n->count() : 0;
+
+	_counts[type] += int(counted) - int(location->counted);
+	_fullCounts[type] += int(count) - int(location->count);
+	_fullCount += int(count) - int(location->count);
+	location->counted = counted;
+	location->count = count;
+}
+
+void NotificationsModel::scheduleFlush()
+{
+	if (!_flushTimer->isActive()) {
+		_flushTimer->start();
+	}
 }
 
 void NotificationsModel::handleNotificationChanged()
@@ -237,9 +353,15 @@ void NotificationsModel::handleNotificationChanged()
 	QObject *obj = sender();
 	if (obj) {
 		Notification* n = static_cast<Notification*>(obj);
-		const int index = getIndexForNotification(n);
+		QHash<Notification*, Location>::iterator it = _locations.find(n);
+		if (it == _locations.end()) return;
+
+		const int index = _offsets[it->type] + getSubindex(it->type, it->seq);
 
 		emit dataChanged(createIndex(index, 0), createIndex(index, 0));
-		emit modelChanged();
+		updateCounts(n, &it.value());
+
+		_pendingChanges.changed++;
+		scheduleFlush();
 	}
 }
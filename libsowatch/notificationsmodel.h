@@ -2,6 +2,9 @@
 #define SOWATCH_NOTIFICATIONSMODEL_H
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QHash>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
 
 #include "notification.h"
 
@@ -32,6 +35,32 @@ public:
 	Notification* at(Notification::Type type, int position) const;
 	Notification* at(const QList<Notification::Type>& types, int position) const;
 
+	/** A cheap read-only view of the notifications of some types, in the
+	 *  order the types are given. It keeps its own table of the first row
+	 *  of each type, which is rebuilt when notifications are added to or
+	 *  removed from the model, so it reflects later changes to it. */
+	class View
+	{
+	public:
+		View(const NotificationsModel *model, const QList<Notification::Type>& types);
+
+		int size() const;
+		Notification* at(int position) const;
+
+	private:
+		void update() const;
+
+		const NotificationsModel *_model;
+		QList<Notification::Type> _types;
+		/** Row of the first notification of each type in the view;
+		 *  the last entry is the total number of rows. */
+		mutable QVector<int> _offsets;
+		/** The model generation _offsets was built for. */
+		mutable uint _generation;
+	};
+
+	View view(const QList<Notification::Type>& types) const;
+
 	void add(Notification *n);
 	void remove(Notification *n);
 	void remove(Notification::Type type, Notification *n);
@@ -47,19 +76,81 @@ public:
 
 	Notification::Type getTypeOfDeletedNotification(Notification *n) const;
 
+	/** What changed in the model since the previous modelChanged(). */
+	struct ChangeSummary {
+		int added;
+		int removed;
+		int changed;
+	};
+
+	/** The changes reported by the last modelChanged() signal. */
+	ChangeSummary lastChanges() const;
+
+	/** How long changes are collected before modelChanged() and
+	 *  countsChanged() are emitted, in milliseconds; with 0 (the default)
+	 *  all changes done during the same event loop iteration are batched. */
+	int batchInterval() const;
+	void setBatchInterval(int msec);
+
+public slots:
+	/** Emits the signals for any pending changes right now. */
+	void flushChanges();
+
 signals:
+	/** Emitted once for a batch of additions, removals and changes;
+	 *  see lastChanges(). */
 	void modelChanged();
+	/** The counts of a type of notifications (as returned by countByType()
+	 *  and fullCountByType()) changed; emitted right before modelChanged(). */
+	void countsChanged(Notification::Type type);
 
 private:
 	int getOffsetForType(Notification::Type type) const;
 	int getAppendOffsetForType(Notification::Type type) const;
 	int getIndexForNotification(Notification *n) const;
+	int getSubindex(Notification::Type type, qint64 seq) const;
 
 private slots:
 	void handleNotificationChanged();
 
 private:
+	/** Where a notification is in the per-type lists, and what it last
+	 *  added to the counts of its type. */
+	struct Location {
+		Notification::Type type;
+		/** Order in which it was added; the per-type lists are sorted by it,
+		 *  so it does not change when other notifications are removed. */
+		qint64 seq;
+		bool counted;
+		uint count;
+	};
+
+	/** Updates the counts with the current state of a notification. */
+	void updateCounts(Notification *n, Location *location);
+	void scheduleFlush();
+
 	QList<Notification*> _list[Notification::TypeCount];
+	/** The seq of each notification in _list. */
+	QList<qint64> _seqs[Notification::TypeCount];
+	qint64 _nextSeq;
+	/** Changes every time a notification is added or removed. */
+	uint _generation;
+	/** Row of the first notification of each type;
+	 *  the last entry is the total number of notifications. */
+	int _offsets[Notification::TypeCount + 1];
+	QHash<Notification*, Location> _locations;
+	/** Running totals of countByType() and fullCountByType(). */
+	int _counts[Notification::TypeCount];
+	int _fullCounts[Notification::TypeCount];
+	int _fullCount;
+
+	/** Delays the signals of a batch of changes. */
+	QTimer *_flushTimer;
+	ChangeSummary _pendingChanges;
+	ChangeSummary _lastChanges;
+	/** Counts as of the last countsChanged() of each type. */
+	int _flushedCounts[Notification::TypeCount];
+	int _flushedFullCounts[Notification::TypeCount];
 };
 
 }
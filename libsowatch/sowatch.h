@@ -9,6 +9,7 @@
 #include "watch.h"
 #include "watchserver.h"
 #include "watchscanner.h"
+#include "watchdamage.h"
 #include "watchpaintengine.h"
 #include "watchplugininterface.h"
 
@@ -17,8 +18,10 @@
 #include "notificationprovider.h"
 #include "notificationplugininterface.h"
 #include "notificationsmodel.h"
+#include "notificationqueue.h"
 
 #include "watchlet.h"
+#include "monoconverter.h"
 #include "graphicswatchlet.h"
 #include "declarativewatchlet.h"
 #include "watchletplugininterface.h"
@@ -4,7 +4,7 @@
 using namespace sowatch;
 
 Watch::Watch(QObject* parent) :
-	QObject(parent)
+	QObject(parent), _notificationAlerts(true), _frameBlocked(false)
 {
 
 }
@@ -14,6 +14,11 @@ Watch::~Watch()
 
 }
 
+int Watch::drainTime() const
+{
+	return 0;
+}
+
 void Watch::vibrate(int msecs)
 {
 	/* The default implementation does nothing. */
@@ -29,3 +34,26 @@ void Watch::setNotificationsModel(NotificationsModel *model)
 {
 	Q_UNUSED(model);
 }
+
+bool Watch::notificationAlerts() const
+{
+	return _notificationAlerts;
+}
+
+void Watch::setNotificationAlerts(bool enabled)
+{
+	_notificationAlerts = enabled;
+}
+
+void Watch::blockFrame()
+{
+	_frameBlocked = true;
+}
+
+void Watch::unblockFrame()
+{
+	if (_frameBlocked) {
+		_frameBlocked = false;
+		emit readyForFrame();
+	}
+}
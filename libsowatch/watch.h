@@ -39,6 +39,9 @@ public:
 	virtual bool isConnected() const = 0;
 	/** Indicates if watch is too busy atm and we should limit frame rate. */
 	virtual bool busy() const = 0;
+	/** Estimated time (in msecs) until the watch has finished sending what
+	 *  has been drawn so far. The default implementation returns 0. */
+	virtual int drainTime() const;
 
 	/** Sets the current date/time on the watch. */
 	virtual void setDateTime(const QDateTime& dateTime) = 0;
@@ -63,11 +66,17 @@ public:
 	virtual void setWatchletsModel(WatchletsModel *model);
 	virtual void setNotificationsModel(NotificationsModel *model);
 
+	/** Whether notifications should alert the user (vibrate, blink a led,
+	 *  etc.) besides being shown. The default is true. */
+	bool notificationAlerts() const;
+	void setNotificationAlerts(bool enabled);
+
 public slots:
 	/** Go back to the idle screen. */
 	virtual void displayIdleScreen() = 0;
-	/** A standard notification; it's up to the watch when to stop showing it. */
-	virtual void displayNotification(Notification* notification) = 0;
+	/** A standard notification; it's up to the watch when to stop showing it.
+	 *  If alert is false, it is shown without alerting the user. */
+	virtual void displayNotification(Notification* notification, bool alert) = 0;
 	/** Enter application mode; after this, server can draw on the QPaintDevice. */
 	virtual void displayApplication() = 0;
 
@@ -97,6 +106,20 @@ signals:
 	void watchletRequested(const QString& id);
 	/** Emitted when closing the current watchlet is requested. */
 	void closeWatchledRequested();
+	/** Emitted when the watch stops being busy after having been busy,
+	 *  so that the next frame can be drawn. */
+	void readyForFrame();
+
+protected:
+	/** Drivers call this whenever busy() becomes true. */
+	void blockFrame();
+	/** Drivers call this whenever busy() becomes false again;
+	 *  emits readyForFrame() if the watch was blocked. */
+	void unblockFrame();
+
+private:
+	bool _notificationAlerts;
+	bool _frameBlocked;
 };
 
 }
@@ -0,0 +1,171 @@
+#include <limits.h>
+
+#include "watchdamage.h"
+
+using namespace sowatch;
+
+DamageAccumulator::~DamageAccumulator()
+{
+}
+
+void DamageAccumulator::addSpans(int top, const int *minX, const int *maxX, int rows)
+{
+	for (int i = 0; i < rows; i++) {
+		if (minX[i] <= maxX[i]) {
+			addRect(QRect(minX[i], top + i, maxX[i] - minX[i] + 1, 1));
+		}
+	}
+}
+
+QRegion DamageAccumulator::regionFromSpans(int top, const int *minX, const int *maxX, int rows)
+{
+	// Build one rect per run of rows with the same span.
+	QVector<QRect> rects;
+	for (int i = 0; i < rows; i++) {
+		const int x0 = minX[i];
+		const int x1 = maxX[i];
+		if (x0 > x1) continue;
+		if (!rects.isEmpty() && rects.last().bottom() == top + i - 1 &&
+		        rects.last().left() == x0 && rects.last().right() == x1) {
+			rects.last().setBottom(top + i);
+		} else {
+			rects.append(QRect(x0, top + i, x1 - x0 + 1, 1));
+		}
+	}
+
+	QRegion region;
+	if (!rects.isEmpty()) {
+		region.setRects(rects.constData(), rects.size());
+	}
+	return region;
+}
+
+void RegionDamage::reset(const QRect& area)
+{
+	_area = area;
+	_region = QRegion();
+}
+
+void RegionDamage::addRect(const QRect& rect)
+{
+	if (!rect.isEmpty()) {
+		_region += rect;
+	}
+}
+
+void RegionDamage::addSpans(int top, const int *minX, const int *maxX, int rows)
+{
+	_region += regionFromSpans(top, minX, maxX, rows);
+}
+
+bool RegionDamage::isEmpty() const
+{
+	return _region.isEmpty();
+}
+
+QRegion RegionDamage::region() const
+{
+	return _region;
+}
+
+void RegionDamage::rowSpans(int *minX, int *maxX) const
+{
+	const int top = _area.top();
+	for (int i = 0; i < _area.height(); i++) {
+		minX[i] = INT_MAX;
+		maxX[i] = INT_MIN;
+	}
+	foreach (const QRect& r, _region.rects()) {
+		for (int y = qMax(r.top(), top); y <= qMin(r.bottom(), _area.bottom()); y++) {
+			minX[y - top] = qMin(minX[y - top], r.left());
+			maxX[y - top] = qMax(maxX[y - top], r.right());
+		}
+	}
+}
+
+RowDamage::RowDamage(bool trackColumns)
+	: _trackColumns(trackColumns), _empty(true)
+{
+}
+
+void RowDamage::reset(const QRect& area)
+{
+	const int rows = area.height();
+	_area = area;
+	_empty = true;
+	if (_rows.size() != rows) {
+		_rows.resize(rows);
+	}
+	_rows.fill(false);
+	if (_trackColumns) {
+		_minX.fill(INT_MAX, rows);
+		_maxX.fill(INT_MIN, rows);
+	}
+}
+
+void RowDamage::addRect(const QRect& rect)
+{
+	const QRect r = rect & _area;
+	if (r.isEmpty()) return;
+
+	const int top = _area.top();
+	_rows.fill(true, r.top() - top, r.bottom() - top + 1);
+	if (_trackColumns) {
+		for (int y = r.top() - top; y <= r.bottom() - top; y++) {
+			_minX[y] = qMin(_minX[y], r.left());
+			_maxX[y] = qMax(_maxX[y], r.right());
+		}
+	}
+	_empty = false;
+}
+
+void RowDamage::addSpans(int top, const int *minX, const int *maxX, int rows)
+{
+	const int first = qMax(top, _area.top());
+	const int last = qMin(top + rows - 1, _area.bottom());
+	for (int y = first; y <= last; y++) {
+		const int i = y - top;
+		const int x0 = qMax(minX[i], _area.left());
+		const int x1 = qMin(maxX[i], _area.right());
+		if (x0 > x1) continue;
+		_rows.setBit(y - _area.top());
+		if (_trackColumns) {
+			_minX[y - _area.top()] = qMin(_minX[y - _area.top()], x0);
+			_maxX[y - _area.top()] = qMax(_maxX[y - _area.top()], x1);
+		}
+		_empty = false;
+	}
+}
+
+bool RowDamage::isEmpty() const
+{
+	return _empty;
+}
+
+QRegion RowDamage::region() const
+{
+	QVector<int> minX(_area.height()), maxX(_area.height());
+	rowSpans(minX.data(), maxX.data());
+	return regionFromSpans(_area.top(), minX.constData(), maxX.constData(), _area.height());
+}
+
+void RowDamage::rowSpans(int *minX, int *maxX) const
+{
+	for (int i = 0; i < _area.height(); i++) {
+		if (!_rows.testBit(i)) {
+			minX[i] = INT_MAX;
+			maxX[i] = INT_MIN;
+		} else if (_trackColumns) {
+			minX[i] = _minX[i];
+			maxX[i] = _maxX[i];
+		} else {
+			minX[i] = _area.left();
+			maxX[i] = _area.right();
+		}
+	}
+}
+
+const QBitArray& RowDamage::rows() const
+{
+	return _rows;
+}
@@ -0,0 +1,83 @@
+#ifndef SOWATCH_WATCHDAMAGE_H
+#define SOWATCH_WATCHDAMAGE_H
+
+#include <QtCore/QBitArray>
+#include <QtCore/QVector>
+#include <QtGui/QRegion>
+#include "sowatch_global.h"
+
+namespace sowatch
+{
+
+/** Collects the areas of a device damaged while painting a frame.
+ *  All coordinates are in device space and already clipped. */
+class SOWATCH_EXPORT DamageAccumulator
+{
+public:
+	virtual ~DamageAccumulator();
+
+	/** Forgets all damage; area is the size of the device. */
+	virtual void reset(const QRect& area) = 0;
+	virtual void addRect(const QRect& rect) = 0;
+	/** Adds a span of columns for each row starting at top;
+	 *  rows where minX > maxX are not damaged. */
+	virtual void addSpans(int top, const int *minX, const int *maxX, int rows);
+
+	virtual bool isEmpty() const = 0;
+	virtual QRegion region() const = 0;
+	/** Fills in, for every row of the area, the smallest span of columns
+	 *  that covers all damage in that row (or minX > maxX if none). */
+	virtual void rowSpans(int *minX, int *maxX) const = 0;
+
+	/** Builds a banded region out of a span of columns for each row. */
+	static QRegion regionFromSpans(int top, const int *minX, const int *maxX, int rows);
+};
+
+/** Keeps the exact damaged region. */
+class SOWATCH_EXPORT RegionDamage : public DamageAccumulator
+{
+public:
+	void reset(const QRect& area);
+	void addRect(const QRect& rect);
+	void addSpans(int top, const int *minX, const int *maxX, int rows);
+
+	bool isEmpty() const;
+	QRegion region() const;
+	void rowSpans(int *minX, int *maxX) const;
+
+private:
+	QRect _area;
+	QRegion _region;
+};
+
+/** Only keeps which rows (and optionally, which span of columns in each
+ *  row) are damaged, which is all line addressed displays need.
+ *  It never allocates memory while painting. */
+class SOWATCH_EXPORT RowDamage : public DamageAccumulator
+{
+public:
+	explicit RowDamage(bool trackColumns = false);
+
+	void reset(const QRect& area);
+	void addRect(const QRect& rect);
+	void addSpans(int top, const int *minX, const int *maxX, int rows);
+
+	bool isEmpty() const;
+	QRegion region() const;
+	void rowSpans(int *minX, int *maxX) const;
+
+	/** One bit per row of the device, set if the row is damaged. */
+	const QBitArray& rows() const;
+
+private:
+	bool _trackColumns;
+	bool _empty;
+	QRect _area;
+	QBitArray _rows;
+	QVector<int> _minX;
+	QVector<int> _maxX;
+};
+
+}
+
+#endif // SOWATCH_WATCHDAMAGE_H
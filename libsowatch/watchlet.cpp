@@ -64,8 +64,9 @@ bool Watchlet::handlesNotification(Notification *notification) const
 	return false;
 }
 
-void Watchlet::openNotification(Notification *notification)
+void Watchlet::openNotification(Notification *notification, int collapsed)
 {
 	Q_UNUSED(notification);
+	Q_UNUSED(collapsed);
 	qDebug() << "Watchlet" << _id << "does not override openNotification()";
 }
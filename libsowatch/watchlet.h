@@ -40,7 +40,9 @@ public:
 	virtual void setNotificationsModel(NotificationsModel *model);
 
 	virtual bool handlesNotification(Notification* notification) const;
-	virtual void openNotification(Notification* notification);
+	/** Shows a notification; collapsed is the number of other pending
+	 *  notifications of the same type that were folded into it. */
+	virtual void openNotification(Notification* notification, int collapsed);
 
 signals:
 	void activeChanged();
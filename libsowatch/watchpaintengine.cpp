@@ -1,6 +1,16 @@
 #include <QtCore/QDebug>
+#include <QtCore/QVarLengthArray>
+#include <limits.h>
+#include <string.h>
 #include <math.h>
 
+// Define SOWATCH_NO_SIMD to only build the portable code, e.g. to test it.
+#if defined(__SSE2__) && !defined(SOWATCH_NO_SIMD)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) && !defined(SOWATCH_NO_SIMD)
+#include <arm_neon.h>
+#endif
+
 #include "watchpaintengine.h"
 
 using namespace sowatch;
@@ -15,27 +25,41 @@ using namespace sowatch;
 
 WatchPaintEngine::WatchPaintEngine()
 	: QPaintEngine(QPaintEngine::AllFeatures),
-	  _painter()
+	  _painter(), _damage(new RegionDamage),
+	  _damageMode(GeometricDamage), _image(0)
 {
 
 }
 
 WatchPaintEngine::~WatchPaintEngine()
 {
-
+	delete _damage;
 }
 
 bool WatchPaintEngine::begin(QPaintDevice *pdev)
 {
-	_damaged = QRegion();
 	_area = QRect(0, 0, pdev->width(), pdev->height());
+	_damage->reset(_area);
 	_hasPen = false;
 	_penWidth = 0.0;
+	_pen = QPen();
 	_hasBrush = false;
 	_clipEnabled = false;
 	_clipRegion = _area;
 	_transform = QTransform();
 
+	_image = 0;
+	if (_damageMode != GeometricDamage && pdev->devType() == QInternal::Image) {
+		_image = static_cast<QImage*>(pdev);
+		// Reuse the snapshot buffer from the previous frame if possible.
+		if (_snapshot.size() != _image->size() ||
+		        _snapshot.format() != _image->format()) {
+			_snapshot = _image->copy();
+		} else {
+			memcpy(_snapshot.bits(), _image->constBits(), _image->byteCount());
+		}
+	}
+
 	TRACE(qDebug() << " -- BEGIN FRAME -----");
 
 	return _painter.begin(pdev);
@@ -44,49 +68,325 @@ bool WatchPaintEngine::begin(QPaintDevice *pdev)
 bool WatchPaintEngine::end()
 {
 	TRACE(qDebug() << " -- END FRAME -------");
-	TRACE(qDebug() << _damaged << "------");
 
-	return _painter.end();
+	bool ret = _painter.end();
+	if (ret && _image) {
+		computePixelDamage();
+	}
+
+	TRACE(qDebug() << _damage->region() << "------");
+
+	return ret;
+}
+
+WatchPaintEngine::DamageMode WatchPaintEngine::damageMode() const
+{
+	return _damageMode;
+}
+
+DamageAccumulator * WatchPaintEngine::damageAccumulator() const
+{
+	return _damage;
+}
+
+void WatchPaintEngine::setDamageAccumulator(DamageAccumulator *damage)
+{
+	Q_ASSERT(damage);
+	delete _damage;
+	_damage = damage;
+	_damage->reset(_area);
+}
+
+QRegion WatchPaintEngine::damagedRegion() const
+{
+	return _damage->region();
+}
+
+void WatchPaintEngine::setDamageMode(DamageMode mode)
+{
+	_damageMode = mode;
+	if (mode == GeometricDamage) {
+		_snapshot = QImage();
+	}
+}
+
+void WatchPaintEngine::discardDamage(const QColor &fill)
+{
+	_damage->reset(_area);
+	if (_image) {
+		// The device now shows this color, so compare against it.
+		QPainter p(&_snapshot);
+		p.setCompositionMode(QPainter::CompositionMode_Source);
+		p.fillRect(_snapshot.rect(), fill);
+	}
+}
+
+#if defined(__SSE2__) && !defined(SOWATCH_NO_SIMD)
+/** Returns true if the 16 bytes at a and b are the same. */
+static inline bool blockEqual(const uchar *a, const uchar *b)
+{
+	const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+	const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xFFFF;
+}
+#elif defined(__ARM_NEON__) && !defined(SOWATCH_NO_SIMD)
+/** Returns true if the 16 bytes at a and b are the same. */
+static inline bool blockEqual(const uchar *a, const uchar *b)
+{
+	const uint64x2_t diff = vreinterpretq_u64_u8(veorq_u8(vld1q_u8(a), vld1q_u8(b)));
+	return (vgetq_lane_u64(diff, 0) | vgetq_lane_u64(diff, 1)) == 0;
+}
+#endif
+
+/** Finds the first and last differing bytes in a and b, if any. */
+static bool findChangedBytes(const uchar *a, const uchar *b, int size,
+                             int *first, int *last)
+{
+	if (memcmp(a, b, size) == 0) {
+		return false; // Most common case
+	}
+
+	int i = 0, j = size;
+	// Compare a block or word at a time until the first different one is found...
+#if (defined(__SSE2__) || defined(__ARM_NEON__)) && !defined(SOWATCH_NO_SIMD)
+	while (i + 16 <= size && blockEqual(a + i, b + i)) {
+		i += 16;
+	}
+#endif
+	while (i + 4 <= size) {
+		quint32 wa, wb;
+		memcpy(&wa, a + i, 4);
+		memcpy(&wb, b + i, 4);
+		if (wa != wb) break;
+		i += 4;
+	}
+	while (a[i] == b[i]) i++;
+	// ... and the same from the end.
+#if (defined(__SSE2__) || defined(__ARM_NEON__)) && !defined(SOWATCH_NO_SIMD)
+	while (j - 16 >= i && blockEqual(a + j - 16, b + j - 16)) {
+		j -= 16;
+	}
+#endif
+	while (j - 4 >= i) {
+		quint32 wa, wb;
+		memcpy(&wa, a + j - 4, 4);
+		memcpy(&wb, b + j - 4, 4);
+		if (wa != wb) break;
+		j -= 4;
+	}
+	while (a[j - 1] == b[j - 1]) j--;
+
+	*first = i;
+	*last = j - 1;
+	return true;
+}
+
+void WatchPaintEngine::computePixelDamage()
+{
+	const int width = _image->width();
+	const int height = _image->height();
+	const int depth = _image->depth();
+	const int lineBytes = (width * depth + 7) / 8;
+
+	// Columns to compare on each row, in bytes.
+	QVarLengthArray<int, 128> minB(height), maxB(height);
+	if (_damageMode == HybridDamage) {
+		_damage->rowSpans(minB.data(), maxB.data());
+		for (int y = 0; y < height; y++) {
+			if (minB[y] <= maxB[y]) {
+				minB[y] = (minB[y] * depth) / 8;
+				maxB[y] = ((maxB[y] + 1) * depth - 1) / 8;
+			}
+		}
+	} else {
+		for (int y = 0; y < height; y++) {
+			minB[y] = 0;
+			maxB[y] = lineBytes - 1;
+		}
+	}
+
+	QVarLengthArray<int, 128> minX(height), maxX(height);
+	for (int y = 0; y < height; y++) {
+		const int b0 = minB[y];
+		int first, last;
+		if (b0 <= maxB[y] &&
+		        findChangedBytes(_image->constScanLine(y) + b0,
+		                         _snapshot.constScanLine(y) + b0,
+		                         maxB[y] - b0 + 1, &first, &last)) {
+			minX[y] = ((b0 + first) * 8) / depth;
+			maxX[y] = qMin(width - 1, ((b0 + last + 1) * 8 - 1) / depth);
+		} else {
+			minX[y] = INT_MAX;
+			maxX[y] = INT_MIN;
+		}
+	}
+
+	_damage->reset(_area);
+	_damage->addSpans(0, minX.constData(), maxX.constData(), height);
 }
 
-void WatchPaintEngine::damageMappedRect(const QRect &r)
+void WatchPaintEngine::damageMappedRect(const QRect &rect)
 {
-	if (_clipEnabled) {
-		TRACE(qDebug() << "Damaging" << _clipRegion.intersected(r));
-		_damaged += _clipRegion.intersected(r);
+	const QRect r = rect & _area;
+	if (r.isEmpty()) return;
+
+	TRACE(qDebug() << "Damaging" << r);
+	if (!_clipEnabled) {
+		_damage->addRect(r);
+	} else if (_clipRegion.rectCount() == 1) {
+		_damage->addRect(r & _clipRegion.boundingRect());
 	} else {
-		TRACE(qDebug() << "Damaging" << r);
-		_damaged += r;
+		foreach (const QRect& clip, _clipRegion.rects()) {
+			_damage->addRect(r & clip);
+		}
 	}
 }
 
+void WatchPaintEngine::damageMappedSpans(int top, int *minX, int *maxX, int rows)
+{
+	if (!_clipEnabled || _clipRegion.rectCount() == 1) {
+		const QRect clip = _clipEnabled ? _clipRegion.boundingRect() & _area : _area;
+		for (int i = 0; i < rows; i++) {
+			const int y = top + i;
+			if (y < clip.top() || y > clip.bottom()) {
+				minX[i] = INT_MAX;
+				maxX[i] = INT_MIN;
+			} else {
+				minX[i] = qMax(minX[i], clip.left());
+				maxX[i] = qMin(maxX[i], clip.right());
+			}
+		}
+		_damage->addSpans(top, minX, maxX, rows);
+	} else {
+		const QRegion region = DamageAccumulator::regionFromSpans(top, minX, maxX, rows);
+		foreach (const QRect& r, region.intersected(_clipRegion).rects()) {
+			_damage->addRect(r & _area);
+		}
+	}
+}
+
+void WatchPaintEngine::damageMappedPolygon(const QPolygonF &polygon)
+{
+	const int n = polygon.size();
+	const QRect bounds = polygon.boundingRect().toAlignedRect() & _area;
+	if (n < 2 || bounds.isEmpty()) return;
+
+	const int top = bounds.top();
+	const int bottom = bounds.bottom();
+	const int rows = bounds.height();
+	QVarLengthArray<int, 128> minX(rows), maxX(rows);
+	for (int i = 0; i < rows; i++) {
+		minX[i] = INT_MAX;
+		maxX[i] = INT_MIN;
+	}
+
+	// Every row a polygon covers is crossed by at least two of its edges,
+	// so the leftmost and rightmost pixels touched by an edge on each row
+	// give a (conservative, for concave polygons) span for that row.
+	for (int i = 0; i < n; i++) {
+		const QPointF& p0 = polygon[i];
+		const QPointF& p1 = polygon[(i + 1) % n];
+		const qreal ya = qMin(p0.y(), p1.y());
+		const qreal yb = qMax(p0.y(), p1.y());
+		const int r0 = qMax(top, static_cast<int>(floor(ya)));
+		const int r1 = qMin(bottom, qMax(static_cast<int>(floor(ya)),
+		                                 static_cast<int>(ceil(yb)) - 1));
+		const qreal dxdy = yb > ya ? (p1.x() - p0.x()) / (p1.y() - p0.y()) : 0.0;
+
+		for (int r = r0; r <= r1; r++) {
+			qreal xa, xb;
+			if (yb > ya) {
+				xa = p0.x() + (qMax(ya, qreal(r)) - p0.y()) * dxdy;
+				xb = p0.x() + (qMin(yb, qreal(r + 1)) - p0.y()) * dxdy;
+			} else {
+				xa = p0.x();
+				xb = p1.x();
+			}
+			const int x0 = static_cast<int>(floor(qMin(xa, xb)));
+			const int x1 = qMax(x0, static_cast<int>(ceil(qMax(xa, xb))) - 1);
+			minX[r - top] = qMin(minX[r - top], x0);
+			maxX[r - top] = qMax(maxX[r - top], x1);
+		}
+	}
+
+	damageMappedSpans(top, minX.data(), maxX.data(), rows);
+}
+
 void WatchPaintEngine::damageRect(const QRect &r)
 {
-	damageMappedRect(_transform.mapRect(r));
+	if (_transform.type() > QTransform::TxScale) {
+		damageMappedPolygon(_transform.map(QPolygonF(QRectF(r))));
+	} else {
+		damageMappedRect(_transform.mapRect(r));
+	}
 }
 
 void WatchPaintEngine::damageRect(const QRectF &r)
 {
-	damageMappedRect(_transform.mapRect(r).toAlignedRect());
+	if (_transform.type() > QTransform::TxScale) {
+		damageMappedPolygon(_transform.map(QPolygonF(r)));
+	} else {
+		damageMappedRect(_transform.mapRect(r).toAlignedRect());
+	}
+}
+
+void WatchPaintEngine::damagePath(const QPainterPath &path)
+{
+	const QPainterPath mapped = _transform.map(path);
+
+	if (_hasBrush) {
+		foreach (const QPolygonF& polygon, mapped.toFillPolygons()) {
+			damageMappedPolygon(polygon);
+		}
+	}
+	if (_hasPen) {
+		QPainterPathStroker stroker;
+		stroker.setWidth(penStrokeWidth());
+		stroker.setCapStyle(_pen.capStyle());
+		stroker.setJoinStyle(_pen.joinStyle());
+		stroker.setMiterLimit(_pen.miterLimit());
+		foreach (const QPolygonF& polygon, stroker.createStroke(mapped).toFillPolygons()) {
+			damageMappedPolygon(polygon);
+		}
+	}
 }
 
 void WatchPaintEngine::damagePenStroke(const QLineF &line)
 {
 	if (!_hasPen) return;
 
-	const qreal a = line.angle();
-	const qreal sn = sinf(a);
-	const qreal cs = cosf(a);
-	const qreal w = _penWidth == 0.0 ? 1.0 : _penWidth;
-	const qreal x1 = line.x1();
-	const qreal x2 = line.x2();
-	const qreal y1 = line.y1();
-	const qreal y2 = line.y2();
-
-	QPointF p1(x1-(w*sn/2.0f), y1+(w*cs/2.0f));
-	QPointF p2(x2+(w*sn/2.0f), y2-(w*cs/2.0f));
-	QRectF r = QRectF(p1, p2).normalized();
-	damageRect(r);
+	const QLineF mapped = _transform.map(line);
+	const qreal w = penStrokeWidth() / 2.0;
+	const qreal len = mapped.length();
+
+	// Unit vectors along and across the line, in device space.
+	QPointF u(1.0, 0.0);
+	if (len > 0.0) {
+		u = (mapped.p2() - mapped.p1()) / len;
+	}
+	const QPointF e = u * w; // Room for the caps
+	const QPointF n = QPointF(-u.y(), u.x()) * w;
+
+	QPolygonF stroke(4);
+	stroke[0] = mapped.p1() - e + n;
+	stroke[1] = mapped.p2() + e + n;
+	stroke[2] = mapped.p2() + e - n;
+	stroke[3] = mapped.p1() - e - n;
+	damageMappedPolygon(stroke);
+}
+
+qreal WatchPaintEngine::penStrokeWidth() const
+{
+	qreal w = _penWidth;
+	if (!_pen.isCosmetic()) {
+		// Scale by the largest stretch of the transform, so that the stroke
+		// is wide enough in every direction even if the scaling is not uniform.
+		const qreal a = _transform.m11() * _transform.m11() + _transform.m12() * _transform.m12()
+		              + _transform.m21() * _transform.m21() + _transform.m22() * _transform.m22();
+		const qreal det = _transform.m11() * _transform.m22() - _transform.m12() * _transform.m21();
+		w *= sqrt((a + sqrt(qMax(qreal(0.0), a * a - 4.0 * det * det))) / 2.0);
+	}
+	return qMax(w, qreal(1.0));
 }
 
 void WatchPaintEngine::updateClipRegion(const QRegion& region, Qt::ClipOperation op)
@@ -117,14 +417,18 @@ void WatchPaintEngine::updateClipRegion(const QRegion& region, Qt::ClipOperation
 void WatchPaintEngine::drawEllipse(const QRectF &r)
 {
 	TRACE(qDebug() << __func__ << r);
-	damageRect(r);
+	QPainterPath path;
+	path.addEllipse(r);
+	damagePath(path);
 	_painter.drawEllipse(r);
 }
 
 void WatchPaintEngine::drawEllipse(const QRect &r)
 {
 	TRACE(qDebug() << __func__ << r);
-	damageRect(r);
+	QPainterPath path;
+	path.addEllipse(QRectF(r));
+	damagePath(path);
 	_painter.drawEllipse(r);
 }
 
@@ -160,7 +464,7 @@ void WatchPaintEngine::drawLines(const QLine *lines, int lineCount)
 void WatchPaintEngine::drawPath(const QPainterPath &path)
 {
 	TRACE(qDebug() << __func__ << path);
-	damageRect(path.boundingRect());
+	damagePath(path);
 	_painter.drawPath(path);
 }
 
@@ -176,9 +480,8 @@ void WatchPaintEngine::drawPoints(const QPointF *points, int pointCount)
 	TRACE(qDebug() << __func__ << points);
 	int i;
 	for (i = 0; i < pointCount; i++) {
-		const QPointF& p = points[i];
-		damageRect(QRectF(p.x() - _penWidth/2.0f, p.y() - _penWidth/2.0f,
-						  _penWidth, _penWidth));
+		// A point is a zero length line; cosmetic pens still draw a pixel.
+		damagePenStroke(QLineF(points[i], points[i]));
 	}
 	_painter.drawPoints(points, pointCount);
 }
@@ -188,9 +491,7 @@ void WatchPaintEngine::drawPoints(const QPoint *points, int pointCount)
 	TRACE(qDebug() << __func__ << points);
 	int i;
 	for (i = 0; i < pointCount; i++) {
-		const QPoint& p = points[i];
-		damageRect(QRect(p.x() - _penWidth/2, p.y() - _penWidth/2,
-						 _penWidth, _penWidth));
+		damagePenStroke(QLineF(points[i], points[i]));
 	}
 	_painter.drawPoints(points, pointCount);
 }
@@ -203,7 +504,13 @@ void WatchPaintEngine::drawPolygon(const QPointF *points, int pointCount, Polygo
 	for (i = 0; i < pointCount; i++) {
 		p[i] = points[i];
 	}
-	damageRect(p.boundingRect());
+	QPainterPath path;
+	path.addPolygon(p);
+	if (mode != PolylineMode) {
+		path.closeSubpath();
+	}
+	path.setFillRule(mode == WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
+	damagePath(path);
 	_painter.drawPolygon(points, pointCount,
 						 mode == WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
 }
@@ -211,12 +518,18 @@ void WatchPaintEngine::drawPolygon(const QPointF *points, int pointCount, Polygo
 void WatchPaintEngine::drawPolygon(const QPoint *points, int pointCount, PolygonDrawMode mode)
 {
 	TRACE(qDebug() << __func__ << points);
-	QPolygon p(pointCount);
+	QPolygonF p(pointCount);
 	int i;
 	for (i = 0; i < pointCount; i++) {
 		p[i] = points[i];
 	}
-	damageRect(p.boundingRect());
+	QPainterPath path;
+	path.addPolygon(p);
+	if (mode != PolylineMode) {
+		path.closeSubpath();
+	}
+	path.setFillRule(mode == WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
+	damagePath(path);
 	_painter.drawPolygon(points, pointCount,
 						 mode == WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
 }
@@ -352,6 +665,7 @@ void WatchPaintEngine::updateState(const QPaintEngineState &state)
 		QPen pen = state.pen();
 		_hasPen = pen.style() != Qt::NoPen;
 		_penWidth = pen.widthF();
+		_pen = pen;
 		_painter.setPen(pen);
 	}
 
@@ -3,6 +3,7 @@
 
 #include <QtGui/QPaintEngine>
 #include "sowatch_global.h"
+#include "watchdamage.h"
 
 namespace sowatch
 {
@@ -12,6 +13,25 @@ class SOWATCH_EXPORT WatchPaintEngine : public QPaintEngine
 public:
 	~WatchPaintEngine();
 
+	/** How the damaged area of each frame is computed. */
+	enum DamageMode {
+		/** From the geometry of every drawing operation. */
+		GeometricDamage,
+		/** By comparing the image before and after painting. */
+		PixelDiffDamage,
+		/** By comparing only the geometrically damaged area. */
+		HybridDamage
+	};
+
+	DamageMode damageMode() const;
+	void setDamageMode(DamageMode mode);
+
+	DamageAccumulator * damageAccumulator() const;
+	/** Replaces the damage accumulator; takes ownership of it. */
+	void setDamageAccumulator(DamageAccumulator *damage);
+	/** The area damaged during the current frame. */
+	QRegion damagedRegion() const;
+
 	/* You are supposed to override these two functions. */
 	bool begin(QPaintDevice *pdev);
 	bool end();
@@ -38,18 +58,39 @@ public:
 protected:
 	WatchPaintEngine();
 
+	/** Call when the device has been filled with a color by other means
+	 *  (e.g. a hardware clear), so that drawing done so far is forgotten. */
+	void discardDamage(const QColor& fill);
+	/** Replaces the damage with the pixels that actually changed. */
+	void computePixelDamage();
+
 	void damageMappedRect(const QRect& r);
+	/** Damages a span of columns for each row; spans are clipped in place. */
+	void damageMappedSpans(int top, int *minX, int *maxX, int rows);
+	/** Damages the rows and columns touched by a device space polygon. */
+	void damageMappedPolygon(const QPolygonF& polygon);
 	void damageRect(const QRect& r);
 	void damageRect(const QRectF& r);
+	/** Damages the area covered by filling and/or stroking a path. */
+	void damagePath(const QPainterPath& path);
 	void damagePenStroke(const QLineF& line);
+	/** Width of the current pen in device pixels, where it is widest. */
+	qreal penStrokeWidth() const;
 	void updateClipRegion(const QRegion& region, Qt::ClipOperation op);
 
 	QPainter _painter;
-	QRegion _damaged;
+	DamageAccumulator *_damage;
 	QRect _area;
 
+	DamageMode _damageMode;
+	/** Image being painted, if any; only used to compute pixel damage. */
+	QImage *_image;
+	/** Contents of _image when painting began. */
+	QImage _snapshot;
+
 	bool _hasPen;
 	qreal _penWidth;
+	QPen _pen;
 
 	bool _hasBrush;
 
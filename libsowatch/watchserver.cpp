@@ -1,4 +1,5 @@
 #include <QtCore/QDebug>
+#include <math.h>
 
 #include "watch.h"
 #include "watchlet.h"
@@ -15,6 +16,9 @@ WatchServer::WatchServer(Watch* watch, QObject* parent) :
     _idleWatchlet(0), _notificationWatchlet(0),
     _watchlets(new WatchletsModel(this)),
     _notifications(new NotificationsModel(this)),
+    _currentNotification(0), _currentCollapsed(0),
+    _rateLimitTimer(new QTimer(this)),
+    _mergedNotifications(0), _deferredNotifications(0), _quietNotifications(0),
     _activeWatchlet(0), _currentWatchlet(0), _currentWatchletIndex(-1),
     _syncTimeTimer(new QTimer(this))
 {
@@ -30,6 +34,15 @@ WatchServer::WatchServer(Watch* watch, QObject* parent) :
 	_syncTimeTimer->setSingleShot(true);
 	_syncTimeTimer->setInterval(24 * 3600 * 1000); // Once a day
 
+	connect(_rateLimitTimer, SIGNAL(timeout()), SLOT(handleRateLimitTimeout()));
+	_rateLimitTimer->setSingleShot(true);
+
+	// No rate limits by default
+	_rateClock.start();
+	setNotificationRateLimit(0, 0);
+	setNotificationTypeRateLimit(0, 0);
+	setVibrationBudget(0, 0);
+
 	_watchlets->setWatchModel(_watch->model());
 	_watch->setWatchletsModel(_watchlets);
 	_watch->setNotificationsModel(_notifications);
@@ -150,6 +163,48 @@ const NotificationsModel * WatchServer::notifications() const
 	return _notifications;
 }
 
+int WatchServer::notificationBatchInterval() const
+{
+	return _notifications->batchInterval();
+}
+
+void WatchServer::setNotificationBatchInterval(int msec)
+{
+	_notifications->setBatchInterval(msec);
+}
+
+void WatchServer::setNotificationRateLimit(int perMinute, int burst)
+{
+	setRateLimit(&_rateLimit, perMinute, burst);
+}
+
+void WatchServer::setNotificationTypeRateLimit(int perMinute, int burst)
+{
+	for (int i = 0; i < Notification::TypeCount; i++) {
+		setRateLimit(&_typeRateLimits[i], perMinute, burst);
+	}
+}
+
+void WatchServer::setVibrationBudget(int perMinute, int burst)
+{
+	setRateLimit(&_vibrationBudget, perMinute, burst);
+}
+
+uint WatchServer::mergedNotifications() const
+{
+	return _mergedNotifications;
+}
+
+uint WatchServer::deferredNotifications() const
+{
+	return _deferredNotifications;
+}
+
+uint WatchServer::quietNotifications() const
+{
+	return _quietNotifications;
+}
+
 void WatchServer::postNotification(Notification *notification)
 {
 	const Notification::Priority priority = notification->priority();
@@ -173,17 +228,18 @@ void WatchServer::postNotification(Notification *notification)
 		return; // Do not care about notifications that old...
 	}
 
-	if (_pendingNotifications.isEmpty()) {
-		_pendingNotifications.enqueue(notification);
-		nextNotification();
-	} else if (priority == Notification::Urgent) {
+	if (!admitNotification(notification)) {
+		return; // Too many notifications lately
+	}
+
+	if (priority == Notification::Urgent && _currentNotification) {
 		// Notification has priority, so we switch to it even if there is
-		// an active notification.
-		_pendingNotifications.prepend(notification);
-		nextNotification();
-	} else {
-		_pendingNotifications.enqueue(notification);
+		// an active notification, which will be shown again afterwards.
+		_pendingNotifications.requeue(_currentNotification);
+		_currentNotification = 0;
 	}
+
+	queueNotification(notification);
 }
 
 void WatchServer::nextNotification()
@@ -193,12 +249,29 @@ void WatchServer::nextNotification()
 		// Deactive active watchlet, if any.
 		deactivateActiveWatchlet();
 	}
-	if (!_pendingNotifications.empty()) {
-		Notification *n = _pendingNotifications.head();
-		_watch->displayNotification(n);
+	if (!_currentNotification && !_pendingNotifications.isEmpty()) {
+		// Notifications that waited for too long are not worth showing anymore
+		QDateTime oldThreshold = QDateTime::currentDateTime().addSecs(-_oldNotificationThreshold);
+		_currentNotification = _pendingNotifications.take(oldThreshold, &_currentCollapsed);
+		if (_currentCollapsed > 0) {
+			qDebug() << "showing" << _currentCollapsed + 1 << "pending notifications of the same type at once";
+		}
+	}
+	if (_currentNotification) {
+		Notification *n = _currentNotification;
+		bool alert = true;
+		if (n->priority() != Notification::Urgent) {
+			alert = hasToken(&_vibrationBudget);
+			if (alert) {
+				takeToken(&_vibrationBudget);
+			} else {
+				_quietNotifications++;
+			}
+		}
+		_watch->displayNotification(n, alert);
 		if (_notificationWatchlet) {
 			activateWatchlet(_notificationWatchlet);
-			_notificationWatchlet->openNotification(n);
+			_notificationWatchlet->openNotification(n, _currentCollapsed);
 		}
 	} else if (_currentWatchlet) {
 		activateCurrentWatchlet();
@@ -318,18 +391,96 @@ void WatchServer::removeNotification(Notification::Type type, Notification *n)
 	_notifications->remove(type, n);
 	_notificationCounts.remove(n);
 
-	if (!_pendingNotifications.isEmpty() && _pendingNotifications.head() == n) {
+	if (_currentNotification == n) {
 		qDebug() << "removing top notification";
-		_pendingNotifications.removeAll(n);
-		nextNotification();
+		dismissCurrentNotification();
 	} else {
-		_pendingNotifications.removeAll(n);
+		_pendingNotifications.remove(n);
 	}
 
 	// No longer interested in this notification
 	disconnect(n, 0, this, 0);
 }
 
+void WatchServer::queueNotification(Notification *n)
+{
+	// Nothing happens if it is already waiting to be shown.
+	_pendingNotifications.enqueue(n);
+	if (!_currentNotification) {
+		nextNotification();
+	}
+}
+
+void WatchServer::dismissCurrentNotification()
+{
+	_currentNotification = 0;
+	nextNotification();
+}
+
+void WatchServer::setRateLimit(RateLimit *limit, int perMinute, int burst)
+{
+	limit->perMinute = qMax(perMinute, 0);
+	limit->burst = qMax(burst, 1);
+	limit->tokens = limit->burst;
+	limit->lastRefill = _rateClock.elapsed();
+}
+
+bool WatchServer::hasToken(RateLimit *limit)
+{
+	if (limit->perMinute == 0) return true;
+
+	const qint64 now = _rateClock.elapsed();
+	limit->tokens = qMin<double>(limit->burst,
+	                             limit->tokens + (now - limit->lastRefill) * limit->perMinute / 60000.0);
+	limit->lastRefill = now;
+
+	return limit->tokens >= 1.0;
+}
+
+void WatchServer::takeToken(RateLimit *limit)
+{
+	if (limit->perMinute > 0) {
+		limit->tokens -= 1.0;
+	}
+}
+
+int WatchServer::msecsToToken(const RateLimit *limit)
+{
+	if (limit->perMinute == 0 || limit->tokens >= 1.0) return 0;
+	return static_cast<int>(ceil((1.0 - limit->tokens) * 60000.0 / limit->perMinute));
+}
+
+bool WatchServer::admitNotification(Notification *n)
+{
+	if (n->priority() == Notification::Urgent) {
+		return true;
+	}
+
+	RateLimit *typeLimit = &_typeRateLimits[n->type()];
+	const bool globalOk = hasToken(&_rateLimit);
+	const bool typeOk = hasToken(typeLimit);
+	if (!globalOk || !typeOk) {
+		if (n == _currentNotification) {
+			qDebug() << "rate limited notification merged into the one on display";
+			_mergedNotifications++;
+		} else {
+			qDebug() << "rate limited notification deferred";
+			if (_pendingNotifications.enqueue(n)) {
+				_deferredNotifications++;
+			}
+			if (!_rateLimitTimer->isActive()) {
+				_rateLimitTimer->start(qMax(msecsToToken(&_rateLimit),
+				                            msecsToToken(typeLimit)));
+			}
+		}
+		return false;
+	}
+
+	takeToken(&_rateLimit);
+	takeToken(typeLimit);
+	return true;
+}
+
 void WatchServer::goToIdle()
 {
 	Q_ASSERT(!_currentWatchlet);
@@ -358,32 +509,65 @@ void WatchServer::handleWatchConnected()
 void WatchServer::handleWatchDisconnected()
 {
 	_syncTimeTimer->stop();
+	_rateLimitTimer->stop();
 	if (_activeWatchlet) {
 		deactivateActiveWatchlet();
 	}
+	_currentNotification = 0;
 	_pendingNotifications.clear();
+	qDebug() << "pending notifications:" << _pendingNotifications.duplicates() << "duplicates ignored,"
+	         << _pendingNotifications.expired() << "expired," << _pendingNotifications.collapsed()
+	         << "collapsed into another";
+	qDebug() << "rate limited notifications:" << _mergedNotifications << "merged,"
+	         << _deferredNotifications << "deferred," << _quietNotifications << "shown without alert";
 	emit watchDisconnected();
 }
 
 void WatchServer::handleWatchIdling()
 {
 	qDebug() << "watch idling";
-	if (!_pendingNotifications.empty()) {
-		_pendingNotifications.dequeue();
-		nextNotification();
+	if (_currentNotification) {
+		dismissCurrentNotification();
 	}
 }
 
+void WatchServer::handleRateLimitTimeout()
+{
+	// Notifications held back by the rate limits are shown now,
+	// unless another one is on display already.
+	if (_currentNotification) return;
+
+	QDateTime oldThreshold = QDateTime::currentDateTime().addSecs(-_oldNotificationThreshold);
+	Notification *n = _pendingNotifications.peek(oldThreshold);
+	if (!n) return;
+
+	if (n->priority() != Notification::Urgent) {
+		// The next one has to wait for both its type and the global limit.
+		RateLimit *typeLimit = &_typeRateLimits[n->type()];
+		const bool globalOk = hasToken(&_rateLimit);
+		const bool typeOk = hasToken(typeLimit);
+		if (!globalOk || !typeOk) {
+			_rateLimitTimer->start(qMax(msecsToToken(&_rateLimit),
+			                            msecsToToken(typeLimit)));
+			return;
+		}
+
+		takeToken(&_rateLimit);
+		takeToken(typeLimit);
+	}
+
+	nextNotification();
+}
+
 void WatchServer::handleNextWatchletRequested()
 {
 	qDebug() << "next watchlet button pressed";
-	if (_pendingNotifications.empty()) {
+	if (!_currentNotification) {
 		// No notifications: either app or idle mode.
 		nextWatchlet();
 	} else {
 		// Skip to next notification if any
-		_pendingNotifications.dequeue();
-		nextNotification();
+		dismissCurrentNotification();
 	}
 }
 
@@ -407,17 +591,18 @@ void WatchServer::handleNotificationChanged()
 
 		qDebug() << "notification changed" << n->title() << "(" << n->count() << ")";
 
-		if (!_pendingNotifications.isEmpty() && _pendingNotifications.head() == n) {
+		if (_currentNotification == n) {
 			// This is the notification that is being currently signaled on the watch
-			// Therefore, show it again no matter what.
-			nextNotification();
-		} else if (n->count() > lastCount) {
-			// This notification now contains an additional "item"; redisplay it.
-			if (_pendingNotifications.isEmpty()) {
-				_pendingNotifications.enqueue(n);
+			// Therefore, show it again, unless new items arrive too fast;
+			// the watchlet already shows the updated notification anyway.
+			if (n->count() <= lastCount || admitNotification(n)) {
 				nextNotification();
-			} else {
-				_pendingNotifications.enqueue(n);
+			}
+		} else if (n->count() > lastCount) {
+			// This notification now contains an additional "item"; redisplay it
+			// (unless it is already waiting to be shown).
+			if (_pendingNotifications.contains(n) || admitNotification(n)) {
+				queueNotification(n);
 			}
 		}
 	}
@@ -4,11 +4,12 @@
 #include <QtCore/QList>
 #include <QtCore/QStringList>
 #include <QtCore/QMap>
-#include <QtCore/QQueue>
 #include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
 
 #include "sowatch_global.h"
 #include "notification.h"
+#include "notificationqueue.h"
 
 namespace sowatch
 {
@@ -51,6 +52,32 @@ public:
 	/** Get a list of all current live notifications. */
 	const NotificationsModel * notifications() const;
 
+	/** How long notification model changes are batched for, in milliseconds;
+	 *  see NotificationsModel::setBatchInterval(). */
+	int notificationBatchInterval() const;
+	void setNotificationBatchInterval(int msec);
+
+	/** Limits how many notifications are shown per minute, all of them
+	 *  together, allowing bursts of up to burst notifications;
+	 *  0 means no limit. Urgent notifications are never limited.
+	 *  Notifications over the limit wait in the queue until the limit
+	 *  allows showing them; updates to the one on display only update
+	 *  its counts in the model. */
+	void setNotificationRateLimit(int perMinute, int burst);
+	/** Same as setNotificationRateLimit(), but for each type separately. */
+	void setNotificationTypeRateLimit(int perMinute, int burst);
+	/** Limits how many notifications per minute alert the user (e.g.
+	 *  vibrate); the rest are shown quietly. */
+	void setVibrationBudget(int perMinute, int burst);
+
+	/** Updates to the notification on display that were not shown
+	 *  again because of the rate limits. */
+	uint mergedNotifications() const;
+	/** Notifications held back by the rate limits to be shown later. */
+	uint deferredNotifications() const;
+	/** Notifications shown without alerting the user. */
+	uint quietNotifications() const;
+
 public slots:
 	void postNotification(Notification *notification);
 	void nextNotification();
@@ -90,11 +117,33 @@ private:
 
 	/** Stores current live notifications. */
 	NotificationsModel *_notifications;
-	/** A list of notifications that are yet to be shown to the user. */
-	QQueue<Notification*> _pendingNotifications;
+	/** The notification being shown on the watch, if any. */
+	Notification *_currentNotification;
+	/** Number of pending notifications collapsed into the one being shown. */
+	int _currentCollapsed;
+	/** Notifications that are yet to be shown to the user. */
+	NotificationQueue _pendingNotifications;
 	/** Stores the count of notifications hidden between each notification object. */
 	QMap<Notification*, uint> _notificationCounts;
 
+	/** A token bucket. */
+	struct RateLimit {
+		int perMinute;
+		int burst;
+		double tokens;
+		qint64 lastRefill;
+	};
+	/** Time source for all the token buckets. */
+	QElapsedTimer _rateClock;
+	RateLimit _rateLimit;
+	RateLimit _typeRateLimits[Notification::TypeCount];
+	RateLimit _vibrationBudget;
+	/** Fires when held back notifications may be shown. */
+	QTimer* _rateLimitTimer;
+	uint _mergedNotifications;
+	uint _deferredNotifications;
+	uint _quietNotifications;
+
 	/** Active watchlet is the one that has "focus" right now. */
 	Watchlet* _activeWatchlet;
 	/** Current watchlet is the app watchlet (not idle, not notification) that is current in the carrousel. */
@@ -107,6 +156,21 @@ private:
 
 	/** Remove a notification of a certain type. */
 	void removeNotification(Notification::Type type, Notification* n);
+	/** Queue a notification to be shown, showing it now if nothing else is. */
+	void queueNotification(Notification *n);
+	/** Stop showing the current notification and show the next one, if any. */
+	void dismissCurrentNotification();
+
+	void setRateLimit(RateLimit *limit, int perMinute, int burst);
+	/** Refills the bucket; returns true if it has a token to take. */
+	bool hasToken(RateLimit *limit);
+	static void takeToken(RateLimit *limit);
+	/** Time until the bucket has a token to take, in msecs. */
+	static int msecsToToken(const RateLimit *limit);
+	/** Checks the rate limits before showing a notification; returns false
+	 *  if it should not be shown now, in which case it was either merged
+	 *  into the one on display or queued until the limits allow it. */
+	bool admitNotification(Notification *n);
 
 	void setWatchletProperties(Watchlet *watchlet);
 	void unsetWatchletProperties(Watchlet *watchlet);
@@ -119,6 +183,7 @@ private slots:
 	void handleWatchConnected();
 	void handleWatchDisconnected();
 	void handleWatchIdling();
+	void handleRateLimitTimeout();
 	void handleNextWatchletRequested();
 	void handleWatchletRequested(const QString& id);
 	void handleCloseWatchletRequested();
@@ -19,11 +19,15 @@ LiveView::LiveView(ConfigKey* settings, QObject* parent) :
     _24hMode(settings->value("24h-mode", false).toBool()),
     _screenWidth(128), _screenHeight(128),
     _mode(RootMenuMode),
-    _paintEngine(0),
-    _rootMenuFirstWatchlet(0),
-    _waitingForAck(NoMessage)
+    _paintEngine(0), _tileCache(TileCacheSize),
+    _rootMenuFirstWatchlet(0), _notificationsMenuDirty(false),
+    _sendWindow(qMax(1, settings->value("send-window", DefaultSendWindow).toInt())),
+    _ackTimer(new QTimer(this)),
+    _roundTripTime(-1), _inFlightSamples(0), _sentSamples(0), _retransmitted(0)
 {
 	initializeAckMap();
+	_ackTimer->setSingleShot(true);
+	connect(_ackTimer, SIGNAL(timeout()), SLOT(handleAckTimeout()));
 	_buttons << "Select" << "Up" << "Down" << "Left" << "Right";
 	initializeRootNotificationItems();
 }
@@ -85,7 +89,35 @@ bool LiveView::busy() const
 {
 	return !_connected ||
 			_socket->state() != QBluetoothSocket::ConnectedState ||
-			_sendingMsgs.size() > 1;
+			_sendingMsgs.size() > _sendWindow;
+}
+
+int LiveView::drainTime() const
+{
+	// Every window worth of messages costs about a round trip.
+	const int rtt = qMax(_roundTripTime, 0);
+	return ((_sendingMsgs.size() + _inFlightMsgs.size()) * rtt) / _sendWindow;
+}
+
+int LiveView::sendWindow() const
+{
+	return _sendWindow;
+}
+
+int LiveView::roundTripTime() const
+{
+	return _roundTripTime;
+}
+
+int LiveView::windowUtilization() const
+{
+	if (_sentSamples == 0) return 0;
+	return (_inFlightSamples * 100) / (quint64(_sentSamples) * _sendWindow);
+}
+
+uint LiveView::retransmittedMessages() const
+{
+	return _retransmitted;
 }
 
 void LiveView::setDateTime(const QDateTime& dateTime)
@@ -130,6 +162,7 @@ bool LiveView::charging() const
 void LiveView::displayIdleScreen()
 {
 	qDebug() << "LiveView display idle screen (cur mode=" << _mode << ")";
+	forgetSentTiles();
 	if (_mode != RootMenuMode) {
 		displayClear();
 		_mode = RootMenuMode;
@@ -137,19 +170,23 @@ void LiveView::displayIdleScreen()
 	}
 }
 
-void LiveView::displayNotification(Notification *notification)
+void LiveView::displayNotification(Notification *notification, bool alert)
 {
 	qDebug() << "LiveView display notification" << notification->title();
 	_mode = NotificationMode;
+	forgetSentTiles();
 	setScreenMode(ScreenMax);
 	setMenuSize(0);
-	enableLed(Qt::green, 0, 250);
-	vibrate(0, 200);
+	if (alert && notificationAlerts()) {
+		enableLed(Qt::green, 0, 250);
+		vibrate(0, 200);
+	}
 }
 
 void LiveView::displayApplication()
 {
 	_mode = ApplicationMode;
+	forgetSentTiles();
 	setMenuSize(0); // This clears up the menu.
 }
 
@@ -177,7 +214,10 @@ void LiveView::setNotificationsModel(NotificationsModel *model)
 	}
 	_notifications = model;
 	if (_notifications) {
-		connect(_notifications, SIGNAL(modelChanged()), SLOT(handleNotificationsChanged()));
+		connect(_notifications, SIGNAL(countsChanged(Notification::Type)),
+		        SLOT(handleNotificationCountsChanged(Notification::Type)));
+		connect(_notifications, SIGNAL(modelChanged()),
+		        SLOT(handleNotificationsModelChanged()));
 		handleNotificationsChanged();
 	}
 }
@@ -191,18 +231,52 @@ void LiveView::renderImage(int x, int y, const QImage &image)
 {
 	const QSize image_size = image.size();
 	qDebug() << "Rendering image at" << x << 'x' << y << "of size" << image.size();
-	QByteArray data;
 	if (image.size().isEmpty()) {
 		return; // Empty image
 	}
 
+	QImage tile;
 	if (image_size.width() > MaxBitmapSize || image_size.height() > MaxBitmapSize) {
 		const QRect new_size(0, 0,
 		                     qMin(MaxBitmapSize, image_size.width()),
 		                     qMin(MaxBitmapSize, image_size.height()));
-		data = encodeImage(image.copy(new_size));
+		tile = image.copy(new_size);
+	} else {
+		tile = image;
+	}
+
+	const QRect rect(QPoint(x, y), tile.size());
+	const quint64 hash = hashImage(tile);
+
+	// Skip the tile if the watch is already showing it at this position,
+	// and forget about whatever it is going to be drawn over.
+	QList<SentTile>::iterator it = _sentTiles.begin();
+	while (it != _sentTiles.end()) {
+		if (it->rect == rect && it->hash == hash) {
+			qDebug() << "Tile is already being shown";
+			return;
+		} else if (it->rect.intersects(rect)) {
+			it = _sentTiles.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	SentTile sent;
+	sent.rect = rect;
+	sent.hash = hash;
+	_sentTiles.append(sent);
+
+	QByteArray data;
+	const QByteArray *cached = _tileCache.object(hash);
+	if (cached) {
+		data = *cached;
 	} else {
-		data = encodeImage(image);
+		data = _tileEncoder.encode(tile);
+		if (data.isEmpty()) {
+			data = encodeImage(tile);
+		}
+		_tileCache.insert(hash, new QByteArray(data), data.size());
 	}
 
 	Q_ASSERT(!data.isEmpty());
@@ -215,6 +289,24 @@ void LiveView::clear()
 	displayClear();
 }
 
+void LiveView::forgetSentTiles()
+{
+	_sentTiles.clear();
+}
+
+void LiveView::forgetSentTile(int x, int y)
+{
+	const QPoint pos(x, y);
+	QList<SentTile>::iterator it = _sentTiles.begin();
+	while (it != _sentTiles.end()) {
+		if (it->rect.topLeft() == pos) {
+			it = _sentTiles.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
 void LiveView::initializeAckMap()
 {
 	if (_ackMap.empty()) {
@@ -263,7 +355,9 @@ void LiveView::initializeRootNotificationItems()
 void LiveView::setupBluetoothWatch()
 {
 	_mode = RootMenuMode;
-	_waitingForAck = NoMessage;
+	_inFlightMsgs.clear();
+	_strayAcks.clear();
+	forgetSentTiles();
 
 	connect(_socket, SIGNAL(readyRead()), SLOT(handleDataReceived()));
 	updateDisplayProperties();
@@ -273,6 +367,20 @@ void LiveView::setupBluetoothWatch()
 void LiveView::desetupBluetoothWatch()
 {
 	_sendingMsgs.clear();
+	_inFlightMsgs.clear();
+	_strayAcks.clear();
+	_ackTimer->stop();
+
+	qDebug() << "round trip time" << _roundTripTime << "ms, window utilization"
+	         << windowUtilization() << "%," << _retransmitted
+	         << "messages retransmitted during this connection";
+	_roundTripTime = -1;
+	_inFlightSamples = 0;
+	_sentSamples = 0;
+	_retransmitted = 0;
+
+	// Nothing can be drawn until the watch is connected again.
+	blockFrame();
 }
 
 void LiveView::recreateNotificationsMenu()
@@ -348,6 +456,29 @@ QByteArray LiveView::encodeImage(const QImage& image)
 	}
 }
 
+quint64 LiveView::hashImage(const QImage& image)
+{
+	// 64-bit FNV-1a over every scanline, seeded with the image geometry.
+	const quint64 prime = Q_UINT64_C(0x100000001b3);
+	quint64 hash = Q_UINT64_C(0xcbf29ce484222325);
+	const int width = image.width();
+	const int height = image.height();
+	const int line_size = (width * image.depth() + 7) / 8;
+
+	hash = (hash ^ image.format()) * prime;
+	hash = (hash ^ width) * prime;
+	hash = (hash ^ height) * prime;
+
+	for (int y = 0; y < height; y++) {
+		const uchar *line = image.constScanLine(y);
+		for (int i = 0; i < line_size; i++) {
+			hash = (hash ^ line[i]) * prime;
+		}
+	}
+
+	return hash;
+}
+
 QByteArray LiveView::encodeImage(const QUrl& url)
 {
 	if (url.encodedPath().endsWith(".png")) {
@@ -369,12 +500,15 @@ QByteArray LiveView::encodeImage(const QUrl& url)
 void LiveView::send(const Message &msg)
 {
 	_sendingMsgs.enqueue(msg);
-	if (_connected && _waitingForAck == NoMessage) {
+	if (_connected && _inFlightMsgs.size() < _sendWindow) {
 		sendMessageFromQueue();
 	} else {
 #if PROTOCOL_DEBUG
-		qDebug() << "Enqueing message while waiting for ack" << _waitingForAck;
+		qDebug() << "Enqueing message while waiting for" << _inFlightMsgs.size() << "acks";
 #endif
+		if (busy()) {
+			blockFrame();
+		}
 	}
 }
 
@@ -409,6 +543,7 @@ void LiveView::displayBitmap(unsigned char x, unsigned char y, const QByteArray
 
 void LiveView::displayClear()
 {
+	forgetSentTiles();
 	send(Message(DisplayClear));
 }
 
@@ -509,11 +644,7 @@ void LiveView::setScreenMode(ScreenBrigthness mode)
 void LiveView::handleMessage(const Message &msg)
 {
 	send(Message(Ack, QByteArray(1, msg.type)));
-	if (msg.type == _waitingForAck) {
-#if PROTOCOL_DEBUG
-		qDebug() << "Got ack to" << _waitingForAck;
-#endif
-		_waitingForAck = NoMessage;
+	if (handleAck(msg.type)) {
 		sendMessageFromQueue();
 	}
 	switch (msg.type) {
@@ -613,8 +744,8 @@ void LiveView::handleNotificationRequest(const Message &msg)
 		return;
 	}
 
-	const QList<Notification::Type> &notification_types = notification_item->notificationTypes;
-	const int num_notifications = _notifications->size(notification_types);
+	const NotificationsModel::View notifications = _notifications->view(notification_item->notificationTypes);
+	const int num_notifications = notifications.size();
 
 	if (_mode != NotificationListMode) {
 		_mode = NotificationListMode;
@@ -650,8 +781,7 @@ void LiveView::handleNotificationRequest(const Message &msg)
 		break;
 	}
 
-	const Notification *notification = _notifications->at(notification_types,
-	                                                      _curNotificationIndex);
+	const Notification *notification = notifications.at(_curNotificationIndex);
 	if (!notification) {
 		sendNotification(_curNotificationIndex, num_notifications, num_notifications,
 		                 "", "", "", QByteArray());
@@ -797,39 +927,179 @@ void LiveView::handleSoftwareVersion(const Message &msg)
 
 
 void LiveView::sendMessageFromQueue()
+{
+	// Keep sending messages until the window is full of unacked ones.
+	while (!_sendingMsgs.empty() && _inFlightMsgs.size() < _sendWindow) {
+		const Message msg = _sendingMsgs.dequeue();
+		const MessageType ack = ackForMessage(msg.type);
+
+		writeMessage(msg);
+
+		if (ack != NoMessage) {
+			InFlightMessage inflight;
+			inflight.msg = msg;
+			inflight.ack = ack;
+			inflight.sent.start();
+			inflight.retransmissions = 0;
+			inflight.copies = 1;
+			_inFlightMsgs.append(inflight);
+
+			_inFlightSamples += _inFlightMsgs.size();
+			_sentSamples++;
+
+			if (!_ackTimer->isActive()) {
+				startAckTimer();
+			}
+		}
+	}
+
+	if (busy()) {
+		blockFrame();
+	} else {
+		unblockFrame();
+	}
+}
+
+void LiveView::writeMessage(const Message &msg)
 {
 	static const int HEADER_SIZE = 6;
-	Q_ASSERT(_waitingForAck == NoMessage);
-
-	// If there are packets to be sent...
-	while (!_sendingMsgs.empty()) {
-		// Send a message to the watch
-		Message msg = _sendingMsgs.dequeue();
-		const quint32 data_size = msg.data.size();
-		QByteArray packet;
-
-		Q_ASSERT(_connected && _socket);
-
-		packet.resize(HEADER_SIZE + data_size);
-		packet[0] = msg.type;
-		packet[1] = HEADER_SIZE - 2;
-		packet[2] = (data_size & 0xFF000000U) >> 24;
-		packet[3] = (data_size & 0x00FF0000U) >> 16;
-		packet[4] = (data_size & 0x0000FF00U) >>  8;
-		packet[5] = (data_size & 0x000000FFU);
-		packet.replace(HEADER_SIZE, data_size, msg.data);
+	const quint32 data_size = msg.data.size();
+	char header[HEADER_SIZE];
+
+	Q_ASSERT(_connected && _socket);
+
+	header[0] = msg.type;
+	header[1] = HEADER_SIZE - 2;
+	header[2] = (data_size & 0xFF000000U) >> 24;
+	header[3] = (data_size & 0x00FF0000U) >> 16;
+	header[4] = (data_size & 0x0000FF00U) >>  8;
+	header[5] = (data_size & 0x000000FFU);
 
 #if PROTOCOL_DEBUG
-		qDebug() << "sending" << msg.type << packet.mid(6, 24).toHex();
+	qDebug() << "sending" << msg.type << msg.data.left(18).toHex();
 #endif
 
-		_socket->write(packet);
+	// The socket buffers the outgoing data, so there is no need to
+	// build a contiguous copy of the packet here.
+	_socket->write(header, HEADER_SIZE);
+	if (data_size > 0) {
+		_socket->write(msg.data);
+	}
+}
+
+bool LiveView::handleAck(MessageType type)
+{
+	// If the first copy of a retransmitted message was only late, the watch
+	// acks every copy. Those extra acks arrive before the acks to any message
+	// sent later, but if the first copy was lost they never arrive at all,
+	// so they are only waited for as long as any other ack.
+	QList<StrayAcks>::iterator sit = _strayAcks.begin();
+	while (sit != _strayAcks.end()) {
+		if (sit->sent.elapsed() >= AckTimeout) {
+			sit = _strayAcks.erase(sit);
+		} else if (sit->ack == type) {
+#if PROTOCOL_DEBUG
+			qDebug() << "Ignoring ack to a retransmitted copy";
+#endif
+			if (--sit->count == 0) {
+				_strayAcks.erase(sit);
+			}
+			return false;
+		} else {
+			++sit;
+		}
+	}
 
-		_waitingForAck = ackForMessage(msg.type);
-		if (_waitingForAck != NoMessage) {
-			break; // Wait for that ack before sending more messages.
+	// Acks of the same type arrive in the same order the messages were sent.
+	for (int i = 0; i < _inFlightMsgs.size(); i++) {
+		const InFlightMessage& inflight = _inFlightMsgs.at(i);
+		if (inflight.ack == type) {
+#if PROTOCOL_DEBUG
+			qDebug() << "Got ack to" << inflight.msg.type;
+#endif
+			// Retransmitted messages are ambiguous, so do not sample them.
+			if (inflight.retransmissions == 0) {
+				const int rtt = inflight.sent.elapsed();
+				if (_roundTripTime < 0) {
+					_roundTripTime = rtt;
+				} else {
+					_roundTripTime = (_roundTripTime * 7 + rtt) / 8;
+				}
+			}
+			if (inflight.copies > 1) {
+				StrayAcks stray;
+				stray.ack = inflight.ack;
+				stray.count = inflight.copies - 1;
+				stray.sent = inflight.sent;
+				_strayAcks.append(stray);
+			}
+			_inFlightMsgs.removeAt(i);
+			startAckTimer();
+			return true;
 		}
 	}
+	return false;
+}
+
+void LiveView::startAckTimer()
+{
+	if (_inFlightMsgs.empty()) {
+		_ackTimer->stop();
+		return;
+	}
+
+	qint64 oldest = 0;
+	foreach (const InFlightMessage& inflight, _inFlightMsgs) {
+		oldest = qMax(oldest, inflight.sent.elapsed());
+	}
+
+	_ackTimer->start(static_cast<int>(qMax<qint64>(0, AckTimeout - oldest)));
+}
+
+void LiveView::handleAckTimeout()
+{
+	bool dropped = false;
+	// Once a message is sent again, all the messages sent after it
+	// are sent again too, so that the watch sees them in the same order
+	// (e.g. a bitmap must not land after a later DisplayClear).
+	bool resending = false;
+
+	QList<InFlightMessage>::iterator it = _inFlightMsgs.begin();
+	while (it != _inFlightMsgs.end()) {
+		const bool timedOut = it->sent.elapsed() >= AckTimeout;
+		if (!timedOut && !resending) {
+			++it;
+			continue;
+		}
+		if (timedOut) {
+			if (it->retransmissions >= MaxRetransmissions) {
+				qWarning() << "Never got an ack to" << it->msg.type << ", giving up";
+				if (it->msg.type == DisplayBitmap) {
+					// The tile might not be on the display, so it must
+					// not be skipped the next time it is drawn.
+					forgetSentTile(static_cast<quint8>(it->msg.data[0]),
+					               static_cast<quint8>(it->msg.data[1]));
+				}
+				it = _inFlightMsgs.erase(it);
+				dropped = true;
+				continue;
+			}
+			qDebug() << "Ack to" << it->msg.type << "timed out, sending it again";
+			it->retransmissions++;
+			_retransmitted++;
+		}
+		writeMessage(it->msg);
+		it->sent.start();
+		it->copies++;
+		resending = true;
+		++it;
+	}
+
+	startAckTimer();
+
+	if (dropped) {
+		sendMessageFromQueue();
+	}
 }
 
 void LiveView::handleDataReceived()
@@ -924,3 +1194,24 @@ void LiveView::handleNotificationsChanged()
 		refreshMenu();
 	}
 }
+
+void LiveView::handleNotificationCountsChanged(Notification::Type type)
+{
+	// Only the unread counts are shown in the menu.
+	foreach (const RootMenuNotificationItem& nitem, _rootNotificationItems) {
+		if (nitem.notificationTypes.contains(type)) {
+			_notificationsMenuDirty = true;
+			return;
+		}
+	}
+}
+
+void LiveView::handleNotificationsModelChanged()
+{
+	// modelChanged() comes after all the countsChanged() of a batch,
+	// so the menu is only sent once per burst of notifications.
+	if (_notificationsMenuDirty) {
+		_notificationsMenuDirty = false;
+		handleNotificationsChanged();
+	}
+}
@@ -1,8 +1,12 @@
 #ifndef LIVEVIEW_H
 #define LIVEVIEW_H
 
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QCache>
 #include <sowatch.h>
 #include <sowatchbt.h>
+#include "liveviewtileencoder.h"
 
 namespace sowatch
 {
@@ -24,6 +28,17 @@ public:
 	QStringList buttons() const;
 
 	bool busy() const;
+	int drainTime() const;
+
+	/** Maximum number of messages that can be waiting for an ack. */
+	int sendWindow() const;
+	/** Smoothed round trip time between a message and its ack, in msecs. */
+	int roundTripTime() const;
+	/** Average number of messages waiting for an ack when a message is sent,
+	 *  as a percentage of the send window. */
+	int windowUtilization() const;
+	/** Number of messages that had to be sent again because of a lost ack. */
+	uint retransmittedMessages() const;
 
 	void setDateTime(const QDateTime& dateTime);
 	void queryDateTime();
@@ -36,7 +51,7 @@ public:
 	bool charging() const;
 
 	void displayIdleScreen();
-	void displayNotification(Notification *notification);
+	void displayNotification(Notification *notification, bool alert);
 	void displayApplication();
 
 	void vibrate(int msecs);
@@ -55,6 +70,14 @@ public:
 
 protected:
 	static const int DelayBetweenMessages = 200;
+	/** Default number of messages that can be waiting for an ack. */
+	static const int DefaultSendWindow = 4;
+	/** Time to wait for an ack before sending the message again. */
+	static const int AckTimeout = 1500;
+	/** Number of times a message is sent again before giving up on it. */
+	static const int MaxRetransmissions = 2;
+	/** Maximum amount of memory used by cached encoded tiles, in bytes. */
+	static const int TileCacheSize = 256 * 1024;
 
 	enum MessageType {
 		NoMessage = 0,
@@ -147,6 +170,30 @@ protected:
 		{ }
 	};
 
+	/** A message that has been sent and is waiting for an ack. */
+	struct InFlightMessage {
+		Message msg;
+		MessageType ack;
+		QElapsedTimer sent;
+		int retransmissions;
+		/** Times it has been written; the watch may ack every copy. */
+		int copies;
+	};
+
+	/** Acks that may still arrive for copies of an already acked message. */
+	struct StrayAcks {
+		MessageType ack;
+		int count;
+		/** Time since the last copy was sent. */
+		QElapsedTimer sent;
+	};
+
+	/** A bitmap that is currently being shown on the watch display. */
+	struct SentTile {
+		QRect rect;
+		quint64 hash;
+	};
+
 	struct RootMenuNotificationItem {
 		QByteArray icon;
 		QString title;
@@ -181,6 +228,14 @@ protected:
 
 	static QByteArray encodeImage(const QImage& image);
 	static QByteArray encodeImage(const QUrl& url);
+	/** Hashes the pixel contents (and size) of an image. */
+	static quint64 hashImage(const QImage& image);
+
+	/** Forget about what is being shown on the display,
+	 *  e.g. because it has been cleared. */
+	void forgetSentTiles();
+	/** Forgets the tile sent at this position, e.g. because it was lost. */
+	void forgetSentTile(int x, int y);
 
 protected:
 	void send(const Message& msg);
@@ -209,11 +264,18 @@ protected:
 
 private:
 	void sendMessageFromQueue();
+	void writeMessage(const Message& msg);
+	/** Removes the oldest in-flight message waiting for this ack type. */
+	bool handleAck(MessageType type);
+	void startAckTimer();
 
 private slots:
+	void handleAckTimeout();
 	void handleDataReceived();
 	void handleWatchletsChanged();
 	void handleNotificationsChanged();
+	void handleNotificationCountsChanged(Notification::Type type);
+	void handleNotificationsModelChanged();
 
 private:
 	ConfigKey *_settings;
@@ -235,14 +297,33 @@ private:
 	// Required by QPaintDevice
 	mutable LiveViewPaintEngine* _paintEngine;
 	QImage _image;
+	LiveViewTileEncoder _tileEncoder;
+	/** Encoded tiles, keyed by their content hash. */
+	QCache<quint64, QByteArray> _tileCache;
+	/** Tiles that are currently being shown on the display. */
+	QList<SentTile> _sentTiles;
 
 	QList<RootMenuItem> _rootMenu;
 	/** Keeps the index of the first watchlet. */
 	int _rootMenuFirstWatchlet;
+	/** Whether the counts of a type in the menu changed in the current
+	 *  batch of notification changes. */
+	bool _notificationsMenuDirty;
 
 	/** Outgoing message queue. */
 	QQueue<Message> _sendingMsgs;
-	MessageType _waitingForAck;
+	/** Messages that have been sent but not acked yet, oldest first. */
+	QList<InFlightMessage> _inFlightMsgs;
+	/** Acks to ignore because they belong to retransmitted copies. */
+	QList<StrayAcks> _strayAcks;
+	int _sendWindow;
+	QTimer *_ackTimer;
+
+	// Transmit statistics
+	int _roundTripTime;
+	quint64 _inFlightSamples;
+	uint _sentSamples;
+	uint _retransmitted;
 	/** Incomplete message that is being received. */
 	Message _receivingMsg;
 };
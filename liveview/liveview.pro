@@ -14,11 +14,15 @@ MOBILITY += connectivity systeminfo
 SOURCES += liveviewplugin.cpp \
     liveviewscanner.cpp \
     liveview.cpp \
-    liveviewpaintengine.cpp
+    liveviewpaintengine.cpp \
+    liveviewtileencoder.cpp
 HEADERS += liveviewplugin.h \
     liveviewscanner.h \
     liveview.h \
-    liveviewpaintengine.h
+    liveviewpaintengine.h \
+    liveviewtileencoder.h
+
+LIBS += -lz
 
 res_files.files += res/graphics res/fonts
 qml_files.files += qml/com qml/liveview-config.qml
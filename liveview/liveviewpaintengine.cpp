@@ -7,6 +7,8 @@ using namespace sowatch;
 LiveViewPaintEngine::LiveViewPaintEngine() :
     WatchPaintEngine(), _watch(0)
 {
+	// Only compare what was drawn over, since the frame buffer is large.
+	setDamageMode(HybridDamage);
 }
 
 bool LiveViewPaintEngine::begin(QPaintDevice *pdev)
@@ -20,18 +22,11 @@ bool LiveViewPaintEngine::end()
 {
 	bool ret = WatchPaintEngine::end();
 	if (ret) {
-		QRect rect = _damaged.boundingRect();
-
-		const int tile_size = LiveView::MaxBitmapSize;
-		// Have to make tiles
-		for (int x = rect.left(); x < rect.right(); x += tile_size) {
-			for (int y = rect.top(); y < rect.bottom(); y += tile_size) {
-				QRect tile(x, y,
-						   qMin(tile_size, rect.width()),
-						   qMin(tile_size, rect.height()));
-				QImage sub_image = _watch->image()->copy(tile);
-				_watch->renderImage(tile.x(), tile.y(), sub_image);
-			}
+		const QList<QRect> tiles = tilesForRegion(damagedRegion(),
+		                                          LiveView::MaxBitmapSize);
+		foreach (const QRect& tile, tiles) {
+			QImage sub_image = _watch->image()->copy(tile);
+			_watch->renderImage(tile.x(), tile.y(), sub_image);
 		}
 	}
 	return ret;
@@ -44,7 +39,7 @@ void LiveViewPaintEngine::drawRects(const QRectF *rects, int rectCount)
 		const QRectF& r = rects[i];
 		if (_hasBrush && fillsEntireImage(r.toRect()) && _isBrushBlack) {
 			_watch->clear();
-			_damaged = QRegion();
+			discardDamage(Qt::black);
 			continue;
 		}
 		if (_hasBrush) {
@@ -67,7 +62,7 @@ void LiveViewPaintEngine::drawRects(const QRect *rects, int rectCount)
 		const QRect& r = rects[i];
 		if (_hasBrush && fillsEntireImage(r) && _isBrushBlack) {
 			_watch->clear();
-			_damaged = QRegion();
+			discardDamage(Qt::black);
 			continue;
 		}
 		if (_hasBrush) {
@@ -99,6 +94,61 @@ void LiveViewPaintEngine::updateState(const QPaintEngineState &state)
 	}
 }
 
+QList<QRect> LiveViewPaintEngine::tilesForRegion(const QRegion& region, int tileSize)
+{
+	QList<QRect> tiles;
+	const QRect bounds = region.boundingRect();
+	if (bounds.isEmpty()) {
+		return tiles;
+	}
+
+	// Cut the region with a tileSize grid, keeping only the bounding rect
+	// of the damaged part inside each grid cell.
+	const int left = bounds.left() - bounds.left() % tileSize;
+	const int top = bounds.top() - bounds.top() % tileSize;
+	for (int y = top; y <= bounds.bottom(); y += tileSize) {
+		for (int x = left; x <= bounds.right(); x += tileSize) {
+			const QRect cell(x, y, tileSize, tileSize);
+			const QRect tile = region.intersected(cell).boundingRect();
+			if (!tile.isEmpty()) {
+				tiles.append(tile);
+			}
+		}
+	}
+
+	// Small damaged areas that straddle a grid line end up split into
+	// several tiles; merge them back whenever the result still fits
+	// in a single bitmap, since each bitmap costs a round trip.
+	// Only tiles whose union is exactly both of them are merged,
+	// so that tiles never overlap and no pixel is sent twice.
+	bool merged;
+	do {
+		merged = false;
+		for (int i = 0; i < tiles.size() && !merged; i++) {
+			for (int j = i + 1; j < tiles.size(); j++) {
+				const QRect& a = tiles[i];
+				const QRect& b = tiles[j];
+				const bool sameRows = a.top() == b.top() && a.bottom() == b.bottom() &&
+				        (a.right() + 1 == b.left() || b.right() + 1 == a.left());
+				const bool sameColumns = a.left() == b.left() && a.right() == b.right() &&
+				        (a.bottom() + 1 == b.top() || b.bottom() + 1 == a.top());
+				if (!sameRows && !sameColumns) {
+					continue;
+				}
+				const QRect united = a.united(b);
+				if (united.width() <= tileSize && united.height() <= tileSize) {
+					tiles[i] = united;
+					tiles.removeAt(j);
+					merged = true;
+					break;
+				}
+			}
+		}
+	} while (merged);
+
+	return tiles;
+}
+
 bool LiveViewPaintEngine::fillsEntireImage(const QRect& rect)
 {
 	return rect == _area &&
@@ -23,6 +23,13 @@ public:
 protected:
 	bool fillsEntireImage(const QRect& rect);
 
+	/** Covers a damaged region with bitmaps of at most tileSize x tileSize:
+	 *  the bounding rect of the damage in each cell of a tileSize grid,
+	 *  greedily merged with its neighbors when they share a whole edge and
+	 *  the result still fits. Tiles never overlap, but the set is not
+	 *  necessarily the smallest possible. */
+	static QList<QRect> tilesForRegion(const QRegion& region, int tileSize);
+
 	LiveView* _watch;
 	bool _isBrushBlack;
 };
@@ -0,0 +1,227 @@
+#include <string.h>
+#include <QtCore/QDebug>
+
+#include "liveviewtileencoder.h"
+
+using namespace sowatch;
+
+static const char pngSignature[8] = {
+	'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'
+};
+
+static inline char * writeBigEndian(char *p, quint32 value)
+{
+	p[0] = (value & 0xFF000000U) >> 24;
+	p[1] = (value & 0x00FF0000U) >> 16;
+	p[2] = (value & 0x0000FF00U) >>  8;
+	p[3] = (value & 0x000000FFU);
+	return p + 4;
+}
+
+/** Expands a RGB16 color to RGB888, the same way QImage does. */
+static inline void expandRgb16(quint16 c, uchar *rgb)
+{
+	const uint r = c >> 11;
+	const uint g = (c >> 5) & 0x3F;
+	const uint b = c & 0x1F;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+LiveViewTileEncoder::LiveViewTileEncoder()
+	: _paletteSize(0)
+{
+	memset(&_zstream, 0, sizeof(_zstream));
+	_zvalid = deflateInit(&_zstream, CompressionLevel) == Z_OK;
+	if (!_zvalid) {
+		qWarning() << "Failed to initialize deflate stream";
+	}
+}
+
+LiveViewTileEncoder::~LiveViewTileEncoder()
+{
+	if (_zvalid) {
+		deflateEnd(&_zstream);
+	}
+}
+
+QByteArray LiveViewTileEncoder::encode(const QImage& image)
+{
+	if (!_zvalid || image.format() != QImage::Format_RGB16 || image.isNull()) {
+		return QByteArray();
+	}
+
+	const int width = image.width();
+	const int height = image.height();
+	int depth, colorType;
+
+	_paletteSize = buildPalette(image);
+	if (_paletteSize > 0) {
+		if (_paletteSize <= 2) depth = 1;
+		else if (_paletteSize <= 4) depth = 2;
+		else if (_paletteSize <= 16) depth = 4;
+		else depth = 8;
+		colorType = 3;
+		filterPalette(image, depth);
+	} else {
+		depth = 8;
+		colorType = 2;
+		filterRgb(image);
+	}
+
+	deflateReset(&_zstream);
+	const int bound = deflateBound(&_zstream, _raw.size());
+	const int plteSize = _paletteSize * 3;
+
+	QByteArray png(sizeof(pngSignature) + (12 + 13) +
+	               (plteSize > 0 ? 12 + plteSize : 0) +
+	               (12 + bound) + 12, Qt::Uninitialized);
+	char *p = png.data();
+	char *chunk;
+
+	memcpy(p, pngSignature, sizeof(pngSignature));
+	p += sizeof(pngSignature);
+
+	chunk = p + 4;
+	p = writeChunkHeader(p, "IHDR", 13);
+	p = writeBigEndian(p, width);
+	p = writeBigEndian(p, height);
+	*p++ = depth;
+	*p++ = colorType;
+	*p++ = 0; // Deflate
+	*p++ = 0; // Adaptive filtering
+	*p++ = 0; // Not interlaced
+	p = writeChunkCrc(p, chunk);
+
+	if (plteSize > 0) {
+		chunk = p + 4;
+		p = writeChunkHeader(p, "PLTE", plteSize);
+		for (int i = 0; i < _paletteSize; i++) {
+			expandRgb16(_palette[i], reinterpret_cast<uchar*>(p));
+			p += 3;
+		}
+		p = writeChunkCrc(p, chunk);
+	}
+
+	// Compress straight into the IDAT chunk; its size is filled in later.
+	char *idat = p;
+	chunk = p + 4;
+	p = writeChunkHeader(p, "IDAT", 0);
+	_zstream.next_in = reinterpret_cast<Bytef*>(_raw.data());
+	_zstream.avail_in = _raw.size();
+	_zstream.next_out = reinterpret_cast<Bytef*>(p);
+	_zstream.avail_out = bound;
+	if (deflate(&_zstream, Z_FINISH) != Z_STREAM_END) {
+		qWarning() << "Failed to compress tile";
+		return QByteArray();
+	}
+	writeBigEndian(idat, _zstream.total_out);
+	p += _zstream.total_out;
+	p = writeChunkCrc(p, chunk);
+
+	chunk = p + 4;
+	p = writeChunkHeader(p, "IEND", 0);
+	p = writeChunkCrc(p, chunk);
+
+	png.resize(p - png.constData());
+
+	return png;
+}
+
+int LiveViewTileEncoder::buildPalette(const QImage& image)
+{
+	const int width = image.width();
+	const int height = image.height();
+	int size = 0;
+
+	memset(_paletteSeen, 0, sizeof(_paletteSeen));
+
+	for (int y = 0; y < height; y++) {
+		const quint16 *line = reinterpret_cast<const quint16*>(image.constScanLine(y));
+		for (int x = 0; x < width; x++) {
+			const quint16 c = line[x];
+			const quint32 bit = 1U << (c & 31);
+			if (_paletteSeen[c >> 5] & bit) {
+				continue;
+			}
+			if (size == MaxPaletteSize) {
+				return 0; // Too many colors
+			}
+			_paletteSeen[c >> 5] |= bit;
+			_paletteIndex[c] = size;
+			_palette[size] = c;
+			size++;
+		}
+	}
+
+	return size;
+}
+
+void LiveViewTileEncoder::filterPalette(const QImage& image, int depth)
+{
+	const int width = image.width();
+	const int height = image.height();
+	const int rowSize = 1 + (width * depth + 7) / 8;
+	const int pixelsPerByte = 8 / depth;
+
+	_raw.resize(rowSize * height);
+	uchar *p = reinterpret_cast<uchar*>(_raw.data());
+
+	// Palette indexes do not benefit much from filtering.
+	for (int y = 0; y < height; y++) {
+		const quint16 *line = reinterpret_cast<const quint16*>(image.constScanLine(y));
+		*p++ = 0; // No filter
+		for (int x = 0; x < width; x += pixelsPerByte) {
+			const int count = qMin(pixelsPerByte, width - x);
+			uint byte = 0;
+			for (int i = 0; i < count; i++) {
+				byte |= _paletteIndex[line[x + i]] << (8 - depth * (i + 1));
+			}
+			*p++ = byte;
+		}
+	}
+}
+
+void LiveViewTileEncoder::filterRgb(const QImage& image)
+{
+	const int width = image.width();
+	const int height = image.height();
+	const int rowSize = 1 + width * 3;
+
+	_raw.resize(rowSize * height);
+	uchar *p = reinterpret_cast<uchar*>(_raw.data());
+
+	// Use the Sub filter on every row, which is what works best for the
+	// flat areas and gradients that are usual on watch screens.
+	for (int y = 0; y < height; y++) {
+		const quint16 *line = reinterpret_cast<const quint16*>(image.constScanLine(y));
+		uchar prev[3] = { 0, 0, 0 };
+		*p++ = 1; // Sub filter
+		for (int x = 0; x < width; x++) {
+			uchar rgb[3];
+			expandRgb16(line[x], rgb);
+			p[0] = rgb[0] - prev[0];
+			p[1] = rgb[1] - prev[1];
+			p[2] = rgb[2] - prev[2];
+			prev[0] = rgb[0];
+			prev[1] = rgb[1];
+			prev[2] = rgb[2];
+			p += 3;
+		}
+	}
+}
+
+char * LiveViewTileEncoder::writeChunkHeader(char *p, const char *type, quint32 size)
+{
+	p = writeBigEndian(p, size);
+	memcpy(p, type, 4);
+	return p + 4;
+}
+
+char * LiveViewTileEncoder::writeChunkCrc(char *p, const char *start)
+{
+	// The CRC covers the chunk type and data.
+	const uLong crc = crc32(0, reinterpret_cast<const Bytef*>(start), p - start);
+	return writeBigEndian(p, crc);
+}
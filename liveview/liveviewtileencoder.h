@@ -0,0 +1,54 @@
+#ifndef LIVEVIEWTILEENCODER_H
+#define LIVEVIEWTILEENCODER_H
+
+#include <QtCore/QByteArray>
+#include <QtGui/QImage>
+#include <zlib.h>
+
+namespace sowatch
+{
+
+/** Encodes small RGB16 tiles as PNG images for the LiveView display.
+ *  It is much faster than going through QImage::save(), since it always
+ *  uses the same row filter, keeps its deflate state between tiles and
+ *  writes a palette image whenever the tile has 256 colors or fewer.
+ */
+class LiveViewTileEncoder
+{
+public:
+	LiveViewTileEncoder();
+	~LiveViewTileEncoder();
+
+	static const int CompressionLevel = 6;
+	static const int MaxPaletteSize = 256;
+
+	/** Encodes a RGB16 image; returns an empty array if the image is in any
+	 *  other format so that the caller can fall back to the generic path. */
+	QByteArray encode(const QImage& image);
+
+private:
+	/** Builds the palette of the image; returns its size or 0 if the
+	 *  image has too many colors. */
+	int buildPalette(const QImage& image);
+	void filterPalette(const QImage& image, int depth);
+	void filterRgb(const QImage& image);
+
+	static char * writeChunkHeader(char *p, const char *type, quint32 size);
+	static char * writeChunkCrc(char *p, const char *start);
+
+	z_stream _zstream;
+	bool _zvalid;
+	/** Filtered scanlines, ready to be compressed. */
+	QByteArray _raw;
+
+	int _paletteSize;
+	quint16 _palette[MaxPaletteSize];
+	/** Palette index of every RGB16 color seen in the current image. */
+	quint8 _paletteIndex[65536];
+	/** Which RGB16 colors have been seen in the current image. */
+	quint32 _paletteSeen[65536 / 32];
+};
+
+}
+
+#endif // LIVEVIEWTILEENCODER_H
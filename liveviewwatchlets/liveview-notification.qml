@@ -5,6 +5,7 @@ LVPage {
 	id: page
 
 	property QtObject curNotification: null;
+	property int collapsedCount: 0;
 
 	Column {
 		id: container
@@ -28,14 +29,20 @@ LVPage {
 			anchors.right: parent.right
 			wrapMode: Text.WordWrap
 		}
+
+		LVLabel {
+			text: "+" + collapsedCount + " more"
+			visible: collapsedCount > 0
+		}
 	}
 
 	function handlesNotification(notification) {
 		return false;
 	}
 
-	function openNotification(notification) {
+	function openNotification(notification, collapsed) {
 		//scrollable.scrollTop();
 		curNotification = notification;
+		collapsedCount = collapsed;
 	}
 }
@@ -1,6 +1,8 @@
 #include <QtCore/QDebug>
+#include <QtCore/QVarLengthArray>
 
 #include "metawatchpaintengine.h"
+#include "metawatchcrc.h"
 #include "metawatch.h"
 
 using namespace sowatch;
@@ -9,70 +11,33 @@ QTM_USE_NAMESPACE
 #define SINGLE_LINE_UPDATE 0
 #define PROTOCOL_DEBUG 0
 
-const char MetaWatch::btnToWatch[8] = {
-	0, 1, 2, 3, 5, 6, -1, -1
-};
-
-const quint8 MetaWatch::bitRevTable[16] = {
-	0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15
-};
-
-const quint16 MetaWatch::crcTable[256] = {
-	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-	0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-	0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-	0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-	0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-	0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-	0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-	0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-	0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-	0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-	0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-	0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-	0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-	0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-	0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-	0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-	0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-	0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-	0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-	0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-	0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-	0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-	0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-	0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-	0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-	0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-	0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-	0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-	0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-	0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-	0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
-};
+/** Size of a LoadLcdTemplate frame. */
+static const int TemplateFrameSize = 1 + 6;
 
-#if 0 /* This snippet was used to build the table seen above. */
-	quint16 remainder;
-	int dividend;
-	quint8 bit;
+/** Number of WriteLcdBuffer messages needed to send some rows. */
+static inline int rowPackets(int rows)
+{
+#if SINGLE_LINE_UPDATE
+	return rows;
+#else
+	return (rows + 1) / 2;
+#endif
+}
 
-	for (dividend = 0; dividend < 256; dividend++) {
-		remainder = dividend << 8;
-		for (bit = 8; bit > 0; bit--) {
-			if (remainder & 0x8000) {
-				remainder = (remainder << 1) ^ 0x1021;
-			} else {
-				remainder = (remainder << 1);
-			}
-		}
-		if ((dividend % 8) == 0) {
-			printf(",\n0x%04hx", remainder);
-		} else {
-			printf(", 0x%04hx", remainder);
-		}
-	}
+/** Size of the WriteLcdBuffer frames needed to send some rows. */
+static inline int rowBytes(int rows)
+{
+	// Each row is the row number plus 12 bytes of data
+#if SINGLE_LINE_UPDATE
+	return rows * (13 + 6);
+#else
+	return (rows / 2) * (26 + 6) + (rows % 2) * (13 + 6);
 #endif
+}
+
+const char MetaWatch::btnToWatch[8] = {
+	0, 1, 2, 3, 5, 6, -1, -1
+};
 
 MetaWatch::MetaWatch(ConfigKey* settings, QObject* parent) :
 	BluetoothWatch(QBluetoothAddress(settings->value("address").toString()), parent),
@@ -81,7 +46,11 @@ MetaWatch::MetaWatch(ConfigKey* settings, QObject* parent) :
 	_watchTime(), _watchBattery(0), _watchCharging(false),
 	_currentMode(IdleMode),	_paintMode(IdleMode),
 	_paintEngine(0),
-	_sendTimer(new QTimer(this))
+	_displayUpToDate(false), _skippedUpdates(0),
+	_uploadPackets(0), _uploadBytes(0),
+	_toSendHead(0), _toSendBytes(0), _sendTimer(new QTimer(this)),
+	_supersededMessages(0), _supersededBytes(0),
+	_linkThroughput(InitialLinkThroughput), _linkSampleBytes(0)
 {
 	// Read current device settings
 	connect(_settings, SIGNAL(subkeyChanged(QString)), SLOT(settingChanged(QString)));
@@ -95,6 +64,11 @@ MetaWatch::MetaWatch(ConfigKey* settings, QObject* parent) :
 
 	_buttonNames << "A" << "B" << "C" << "D" << "E" << "F";
 
+	for (int i = 0; i < 3; i++) {
+		_toSendLastTemplate[i] = 0;
+		_pendingTemplate[i] = -1;
+	}
+
 	// Configure timers (but do not turn them on yet)
 	_idleTimer->setInterval(_notificationTimeout * 1000);
 	_idleTimer->setSingleShot(true);
@@ -103,7 +77,7 @@ MetaWatch::MetaWatch(ConfigKey* settings, QObject* parent) :
 	_ringTimer->setInterval(DelayBetweenRings);
 	connect(_ringTimer, SIGNAL(timeout()), SLOT(timedRing()));
 
-	_sendTimer->setInterval(DelayBetweenMessages);
+	_sendTimer->setSingleShot(true);
 	connect(_sendTimer, SIGNAL(timeout()), SLOT(timedSend()));
 }
 
@@ -137,7 +111,41 @@ bool MetaWatch::busy() const
 {
 	return !_connected ||
 			_socket->state() != QBluetoothSocket::ConnectedState ||
-			_toSend.size() > 20;
+			queueDrainTime() > MaxQueueDrainTime;
+}
+
+int MetaWatch::drainTime() const
+{
+	return queueDrainTime();
+}
+
+int MetaWatch::linkThroughput() const
+{
+	return _linkThroughput;
+}
+
+int MetaWatch::queuedBytes() const
+{
+	int bytes = _toSendBytes;
+	if (_socket) {
+		bytes += _socket->bytesToWrite();
+	}
+	return bytes;
+}
+
+int MetaWatch::queueDrainTime() const
+{
+	return (queuedBytes() * 1000) / _linkThroughput;
+}
+
+uint MetaWatch::supersededMessages() const
+{
+	return _supersededMessages;
+}
+
+uint MetaWatch::supersededBytes() const
+{
+	return _supersededBytes;
 }
 
 void MetaWatch::setDateTime(const QDateTime &dateTime)
@@ -203,7 +211,7 @@ void MetaWatch::displayIdleScreen()
 	setVibrateMode(false, 0, 0, 0);
 }
 
-void MetaWatch::displayNotification(Notification *notification)
+void MetaWatch::displayNotification(Notification *notification, bool alert)
 {
 	_currentMode = NotificationMode;
 	_paintMode = NotificationMode;
@@ -215,7 +223,9 @@ void MetaWatch::displayNotification(Notification *notification)
 		_idleTimer->stop();
 	} else {
 		_ringTimer->stop();
-		setVibrateMode(true, VibrateLength, VibrateLength, 2);
+		if (alert && notificationAlerts()) {
+			setVibrateMode(true, VibrateLength, VibrateLength, 2);
+		}
 		_idleTimer->start();
 	}
 }
@@ -264,16 +274,25 @@ void MetaWatch::ungrabButton(Mode mode, Button button)
 
 void MetaWatch::setupBluetoothWatch()
 {
-	_partialReceived.type = NoMessage;
-	_partialReceived.data.clear();
+	_parser.clear();
 	_currentMode = IdleMode;
 	_paintMode = IdleMode;
 
+	// We cannot know what the watch is displaying now.
+	invalidateShadow(IdleMode);
+	invalidateShadow(ApplicationMode);
+	invalidateShadow(NotificationMode);
+	_displayUpToDate = false;
+
+	_linkSample.invalidate();
+
 	if (_socket) {
 		// If we are running under the simulator, there might not be
 		// a socket.
 		connect(_socket, SIGNAL(readyRead()),
 	        SLOT(dataReceived()));
+		connect(_socket, SIGNAL(bytesWritten(qint64)),
+		        SLOT(dataWritten(qint64)));
 	}
 
 	// Configure the watch according to user preferences
@@ -285,58 +304,150 @@ void MetaWatch::setupBluetoothWatch()
 
 void MetaWatch::desetupBluetoothWatch()
 {
+	qDebug() << "superseded" << _supersededMessages << "messages"
+	         << "(" << _supersededBytes << "bytes) and skipped"
+	         << _skippedUpdates << "updates during this connection";
+	qDebug() << "sent" << _uploadPackets << "LCD packets"
+	         << "(" << _uploadBytes << "bytes) during this connection";
+	_supersededMessages = 0;
+	_supersededBytes = 0;
+	_skippedUpdates = 0;
+	_uploadPackets = 0;
+	_uploadBytes = 0;
+
+	for (int i = 0; i < 3; i++) {
+		_pendingTemplate[i] = -1;
+	}
+
 	_toSend.clear();
+	_toSendIndex.clear();
+	_toSendBytes = 0;
 	_sendTimer->stop();
+	_linkSample.invalidate();
+
+	// Nothing can be drawn until the watch is connected again.
+	blockFrame();
 }
 
-quint16 MetaWatch::calcCrc(const QByteArray &data, int size)
+int MetaWatch::frameSize(const Message &msg)
 {
-	quint16 remainder = 0xFFFF;
-
-	for (int i = 0; i < size; i++) {
-		quint8 byte = data[i];
-		byte = (bitRevTable[byte & 0xF] << 4) | bitRevTable[(byte & 0xF0) >> 4];
-		remainder = crcTable[byte ^ (remainder >> 8)] ^ (remainder << 8);
+	if (msg.lineA >= 0) {
+		// Each row is the row number plus 12 bytes of data
+		return (msg.lineB >= 0 ? 26 : 13) + 6;
 	}
-
-	return remainder;
+	return msg.data.size() + 6;
 }
 
-quint16 MetaWatch::calcCrc(const Message& msg)
+quint32 MetaWatch::messageKey(const Message &msg)
 {
-	QByteArray data;
-	const int msgSize = msg.data.size();
-
-	data.resize(msgSize + 4);
-	data[0] = 0x01;
-	data[1] = msgSize + 6;
-	data[2] = msg.type;
-	data[3] = msg.options;
-	data.replace(4, msgSize, msg.data);
+	const quint32 type = quint32(msg.type) << 24;
+	const quint32 mode = quint32(msg.options & 0x3) << 16;
 
-	return calcCrc(data, msgSize + 4);
+	switch (msg.type) {
+	case WriteLcdBuffer:
+		if (msg.lineA >= 0) {
+			return type | mode | (quint8(msg.lineA) << 8) | quint8(msg.lineB);
+		} else if (msg.options & (1 << 4)) {
+			// Single row message.
+			return type | mode | (quint8(msg.data[0]) << 8) | 0xFF;
+		} else {
+			return type | mode | (quint8(msg.data[0]) << 8) | quint8(msg.data[13]);
+		}
+	case UpdateLcdDisplay:
+	case LoadLcdTemplate:
+		return type | mode;
+	case SetVibrateMode:
+		// A disable must not supersede a pending enable, or the
+		// alert would never vibrate; only the same kind is replaced.
+		return type | quint8(msg.data[0]);
+	default:
+		return type;
+	}
 }
 
 void MetaWatch::send(const Message &msg)
 {
+	const quint32 key = messageKey(msg);
+	QHash<quint32, uint>::iterator it = _toSendIndex.find(key);
+
+	if (it != _toSendIndex.end()) {
+		const uint seq = it.value();
+		const int mode = msg.options & 0x3;
+		uint templ;
+
+		switch (msg.type) {
+		case WriteLcdBuffer:
+			templ = _toSendLastTemplate[mode] - _toSendHead;
+			if (templ >= uint(_toSend.size()) || templ < seq - _toSendHead) {
+				// No template is going to be loaded after the queued write to
+				// these rows, so we can just replace its contents in place.
+				Message& queued = _toSend[seq - _toSendHead];
+				_supersededMessages++;
+				_supersededBytes += frameSize(queued);
+				// Rows without data will be read from the framebuffer anyway.
+				queued.data = msg.data;
+				return;
+			}
+			// Otherwise, the older write is going to be overwritten anyway.
+			supersedeQueued(seq);
+			break;
+		case UpdateLcdDisplay:
+		case LoadLcdTemplate:
+		case ChangeMode:
+		case SetVibrateMode:
+			// These have to keep their order relative to the row writes,
+			// so drop the older one and queue the newer at the end.
+			supersedeQueued(seq);
+			break;
+		default:
+			break;
+		}
+	}
+
+	const uint seq = _toSendHead + _toSend.size();
+	if (msg.type == LoadLcdTemplate) {
+		_toSendLastTemplate[msg.options & 0x3] = seq;
+	}
+
 	_toSend.enqueue(msg);
+	_toSendIndex.insert(key, seq);
+	_toSendBytes += frameSize(msg);
 	if (!_sendTimer->isActive()) {
-		_sendTimer->start();
+		// Send from the event loop, so that all the messages
+		// generated by the current operation can be batched together.
+		_sendTimer->start(0);
+	}
+	if (busy()) {
+		blockFrame();
 	}
 }
 
 void MetaWatch::sendIfNotQueued(const Message& msg)
 {
-	foreach (const Message& m, _toSend) {
-		if (m.type == msg.type) {
-			return; // Already on the queue, discard message.
-		}
+	if (_toSendIndex.contains(messageKey(msg))) {
+		return; // Already on the queue, discard message.
 	}
 
 	// Otherwise, send it as requested
 	send(msg);
 }
 
+void MetaWatch::supersedeQueued(uint seq)
+{
+	Message& queued = _toSend[seq - _toSendHead];
+
+	Q_ASSERT(queued.type != NoMessage);
+
+	const int size = frameSize(queued);
+	_toSendBytes -= size;
+	_supersededMessages++;
+	_supersededBytes += size;
+
+	// Leave a hole in the queue, so that sequence numbers do not change.
+	queued.type = NoMessage;
+	queued.data.clear();
+}
+
 void MetaWatch::updateWatchProperties()
 {
 	quint8 optBits = 0;
@@ -371,65 +482,22 @@ void MetaWatch::setVibrateMode(bool enable, uint on, uint off, uint cycles)
 	send(msg);
 }
 
-void MetaWatch::updateLcdLine(Mode mode, const QImage& image, int line)
+void MetaWatch::updateLcdLine(Mode mode, int line)
 {
-	Message msg(WriteLcdBuffer, QByteArray(13, 0), (1 << 4) | (mode & 0x3));
-	const char * scanLine = (const char *) image.constScanLine(line);
-
-	msg.data[0] = line;
-	msg.data.replace(1, 12, scanLine, 12);
-
+	// Contents will be read from the framebuffer when actually sending.
+	Message msg(WriteLcdBuffer, QByteArray(), (1 << 4) | (mode & 0x3));
+	msg.lineA = line;
 	send(msg);
 }
 
-void MetaWatch::updateLcdLines(Mode mode, const QImage& image, int lineA, int lineB)
+void MetaWatch::updateLcdLines(Mode mode, int lineA, int lineB)
 {
-	Message msg(WriteLcdBuffer, QByteArray(26, 0), mode & 0x3);
-	const char * scanLine = (const char *) image.constScanLine(lineA);
-
-	msg.data[0] = lineA;
-	msg.data.replace(1, 12, scanLine, 12);
-
-	scanLine = (const char *) image.constScanLine(lineB);
-	msg.data[13] = lineB;
-	msg.data.replace(14, 12, scanLine, 12);
-
+	Message msg(WriteLcdBuffer, QByteArray(), mode & 0x3);
+	msg.lineA = lineA;
+	msg.lineB = lineB;
 	send(msg);
 }
 
-void MetaWatch::updateLcdLines(Mode mode, const QImage& image, const QVector<bool>& lines)
-{
-	int lineCount = lines.count(true);
-	int lineA = -1;
-
-	if (lineCount == 0) return;
-
-	qDebug() << "sending" << lineCount << "rows to watch";
-
-	for (int line = 0; line < lines.size(); line++) {
-		if (lines[line]) {
-			lineCount--;
-#if SINGLE_LINE_UPDATE
-			updateLcdLine(mode, image, line);
-			continue;
-#endif
-			if (lineA >= 0) {
-				// We have a pair of lines to send.
-				updateLcdLines(mode, image, lineA, line);
-				lineA = -1;
-			} else if (lineCount > 0) {
-				// Still another line to send.
-				lineA = line;
-			} else {
-				updateLcdLine(mode, image, line);
-				break; // No more lines
-			}
-		}
-	}
-
-
-}
-
 void MetaWatch::configureLcdIdleSystemArea(bool entireScreen)
 {
 	Message msg(ConfigureLcdIdleBufferSize, QByteArray(1, entireScreen ? 1 : 0));
@@ -439,22 +507,45 @@ void MetaWatch::configureLcdIdleSystemArea(bool entireScreen)
 void MetaWatch::updateLcdDisplay(Mode mode, int startRow, int numRows)
 {
 	Message msg(UpdateLcdDisplay, QByteArray(), mode & 0x3);
+	if (startRow != 0 || numRows != 0) {
+		// This message is going to supersede any queued update of the same
+		// mode, so it has to refresh the rows of that one too.
+		QHash<quint32, uint>::const_iterator it = _toSendIndex.constFind(messageKey(msg));
+		if (it != _toSendIndex.constEnd()) {
+			const Message& queued = _toSend.at(it.value() - _toSendHead);
+			if (queued.data.isEmpty()) {
+				startRow = 0;
+				numRows = 0;
+			} else {
+				const int queuedStart = quint8(queued.data[0]);
+				const int end = qMax(startRow + numRows, queuedStart + quint8(queued.data[1]));
+				startRow = qMin(startRow, queuedStart);
+				numRows = end - startRow;
+			}
+		}
+	}
 	if (startRow != 0 || numRows != 0) {
 		msg.data = QByteArray(2, 0);
 		msg.data[0] = startRow;
 		msg.data[1] = numRows;
 	}
+	if (mode == _currentMode) {
+		_displayUpToDate = true;
+	}
 	send(msg);
 }
 
 void MetaWatch::loadLcdTemplate(Mode mode, int templ)
 {
 	Message msg(LoadLcdTemplate, QByteArray(1, templ), mode & 0x3);
+	invalidateShadow(mode);
 	send(msg);
 }
 
 void MetaWatch::changeMode(Mode mode)
 {
+	// The new mode buffer will not be shown until the next UpdateLcdDisplay.
+	_displayUpToDate = false;
 	send(Message(ChangeMode, QByteArray(), mode & 0x3));
 }
 
@@ -488,6 +579,140 @@ void MetaWatch::disableButton(Mode mode, Button button, ButtonPress press)
 	send(msg);
 }
 
+void MetaWatch::invalidateShadow(Mode mode)
+{
+	const QImage& image = _image[mode];
+	const int rowSize = image.width() / 8;
+
+	_shadow[mode].fill(0, rowSize * image.height());
+	_shadowValid[mode].fill(false, image.height());
+}
+
+void MetaWatch::fillShadow(Mode mode, int templ)
+{
+	const QImage& image = _image[mode];
+	const int rowSize = image.width() / 8;
+
+	_shadow[mode].fill(templ ? '\xff' : '\0', rowSize * image.height());
+	_shadowValid[mode].fill(true, image.height());
+}
+
+bool MetaWatch::lineChanged(Mode mode, int line) const
+{
+	const QImage& image = _image[mode];
+	const int rowSize = image.width() / 8;
+	const char *scanLine = reinterpret_cast<const char*>(image.constScanLine(line));
+	const char *shadowLine = _shadow[mode].constData() + line * rowSize;
+
+	Q_ASSERT(line < _shadowValid[mode].size());
+
+	return !_shadowValid[mode].testBit(line) ||
+	        memcmp(shadowLine, scanLine, rowSize) != 0;
+}
+
+bool MetaWatch::lineMatchesTemplate(Mode mode, int line, int templ) const
+{
+	const QImage& image = _image[mode];
+	const int rowSize = image.width() / 8;
+	const uchar *scanLine = image.constScanLine(line);
+	const uchar fill = templ ? 0xFF : 0x00;
+
+	for (int i = 0; i < rowSize; i++) {
+		if (scanLine[i] != fill) {
+			return false;
+		}
+	}
+	return true;
+}
+
+MetaWatch::UploadPlan MetaWatch::planUpload(Mode mode, const QBitArray& lines) const
+{
+	const QImage& image = _image[mode];
+	const int numLines = image.height();
+	const int pendingTemplate = _pendingTemplate[mode];
+	UploadPlan plan;
+
+	// Plain row writes: if the framebuffer was cleared, the watch buffer
+	// was not, so every row needs to be checked against it. Rows we know
+	// nothing about (e.g. after a reconnect) have to be sent even if the
+	// framebuffer did not change.
+	for (int line = 0; line < numLines; line++) {
+		if ((pendingTemplate >= 0 || !_shadowValid[mode].testBit(line) ||
+		     (line < lines.size() && lines.testBit(line))) &&
+		        lineChanged(mode, line)) {
+			plan.lines.append(line);
+		}
+	}
+	plan.packets = rowPackets(plan.lines.size());
+	plan.bytes = rowBytes(plan.lines.size());
+
+	if (plan.lines.isEmpty()) {
+		return plan;
+	}
+
+	// Loading a template and then writing only the rows that differ from
+	// it, which pays off for mostly blank frames.
+	for (int templ = 0; templ < 2; templ++) {
+		int count = 0;
+		for (int line = 0; line < numLines; line++) {
+			if (!lineMatchesTemplate(mode, line, templ)) {
+				count++;
+			}
+		}
+
+		const int bytes = TemplateFrameSize + rowBytes(count);
+		if (bytes < plan.bytes) {
+			plan.templ = templ;
+			plan.lines.clear();
+			for (int line = 0; line < numLines; line++) {
+				if (!lineMatchesTemplate(mode, line, templ)) {
+					plan.lines.append(line);
+				}
+			}
+			plan.packets = 1 + rowPackets(count);
+			plan.bytes = bytes;
+		}
+	}
+
+	return plan;
+}
+
+void MetaWatch::sendUpload(Mode mode, const UploadPlan &plan)
+{
+	const int lineCount = plan.lines.size();
+
+	if (plan.templ >= 0) {
+		loadLcdTemplate(mode, plan.templ);
+	}
+
+	if (plan.packets == 0) return;
+
+	if (plan.templ >= 0) {
+		qDebug() << "sending template" << plan.templ << "and" << lineCount << "rows to watch in"
+		         << plan.packets << "packets," << plan.bytes << "bytes";
+	} else {
+		qDebug() << "sending" << lineCount << "rows to watch in"
+		         << plan.packets << "packets," << plan.bytes << "bytes";
+	}
+	_uploadPackets += plan.packets;
+	_uploadBytes += plan.bytes;
+
+#if SINGLE_LINE_UPDATE
+	for (int i = 0; i < lineCount; i++) {
+		updateLcdLine(mode, plan.lines[i]);
+	}
+#else
+	int i;
+	for (i = 0; i + 1 < lineCount; i += 2) {
+		// We have a pair of lines to send.
+		updateLcdLines(mode, plan.lines[i], plan.lines[i + 1]);
+	}
+	if (i < lineCount) {
+		updateLcdLine(mode, plan.lines[i]);
+	}
+#endif
+}
+
 void MetaWatch::handleMessage(const Message &msg)
 {
 	switch (msg.type) {
@@ -639,21 +864,60 @@ void MetaWatch::settingChanged(const QString &key)
 
 void MetaWatch::dataReceived()
 {
-	realReceive(false);
+	char buffer[256];
+	qint64 dataRead;
+
+	while ((dataRead = _socket->read(buffer, sizeof(buffer))) > 0) {
+#if PROTOCOL_DEBUG
+		qDebug() << "received" << QByteArray(buffer, dataRead).toHex();
+#endif
+		_parser.append(buffer, dataRead);
+	}
+
+	MetaWatchFrameParser::Frame frame;
+	while (_parser.next(&frame)) {
+		// The message data points directly into the parser's buffer.
+		const Message msg(static_cast<MessageType>(frame.type),
+		                  QByteArray::fromRawData(frame.data, frame.size),
+		                  frame.options);
+#if PROTOCOL_DEBUG
+		qDebug() << "received" << msg.type << msg.options << msg.data.toHex();
+#endif
+		handleMessage(msg);
+	}
 }
 
-void MetaWatch::timedSend()
+void MetaWatch::dataWritten(qint64 bytes)
 {
-	// If there are packets to be sent...
-	if (_toSend.count() > 0) {
-		// Send the packets to the watch
-		realSend(_toSend.dequeue());
-	}
-	// If we sent all packets...
-	if (_toSend.count() == 0) {
-		// Stop the send timer to save battery
-		_sendTimer->stop();
+	_linkSampleBytes += bytes;
+
+	if (_linkSample.isValid()) {
+		const qint64 elapsed = _linkSample.elapsed();
+		const bool drained = _socket->bytesToWrite() == 0;
+		if (elapsed >= LinkSampleTime || (drained && elapsed > 0)) {
+			const int sample = (_linkSampleBytes * 1000) / elapsed;
+			// Smooth the estimate a bit, since samples are noisy.
+			_linkThroughput = qMax(1, (_linkThroughput * 3 + sample) / 4);
+#if PROTOCOL_DEBUG
+			qDebug() << "link throughput" << _linkThroughput << "bytes/s";
+#endif
+			_linkSampleBytes = 0;
+			if (drained) {
+				// The link is now idle; do not count that time.
+				_linkSample.invalidate();
+			} else {
+				_linkSample.restart();
+			}
+		}
 	}
+
+	// The socket has room for more data now.
+	sendFromQueue();
+}
+
+void MetaWatch::timedSend()
+{
+	sendFromQueue();
 }
 
 void MetaWatch::timedRing()
@@ -661,114 +925,105 @@ void MetaWatch::timedRing()
 	setVibrateMode(true, RingLength, RingLength, 3);
 }
 
-void MetaWatch::realSend(const Message &msg)
+void MetaWatch::sendFromQueue()
 {
-	const int msgSize = msg.data.size();
-	QByteArray data;
-	quint16 crc;
+	if (!_connected || !_socket) return;
 
-	Q_ASSERT(_connected && _socket);
+	// Fill the socket buffer with as many packets as it can absorb
+	while (!_toSend.isEmpty() && _socket->bytesToWrite() < MaxBytesToWrite) {
+		const Message msg = _toSend.dequeue();
+		const uint seq = _toSendHead++;
 
-	data.resize(msgSize + 6);
-	data[0] = 0x01;
-	data[1] = msgSize + 6;
-	data[2] = msg.type;
-	data[3] = msg.options;
-	data.replace(4, msgSize, msg.data);
-	crc = calcCrc(data, msgSize + 4);
-	data[msgSize+4] = crc & 0xFF;
-	data[msgSize+5] = crc >> 8;
+		if (msg.type == NoMessage) {
+			continue; // This message was superseded
+		}
 
-#if PROTOCOL_DEBUG
-	qDebug() << "sending" << data.toHex();
-#endif
+		QHash<quint32, uint>::iterator it = _toSendIndex.find(messageKey(msg));
+		if (it != _toSendIndex.end() && it.value() == seq) {
+			_toSendIndex.erase(it);
+		}
+
+		_toSendBytes -= frameSize(msg);
+		realSend(msg);
+	}
+
+	if (_toSend.isEmpty()) {
+		// Stop the send timer to save battery
+		_sendTimer->stop();
+	} else if (!_sendTimer->isActive()) {
+		// Normally bytesWritten() will wake us up again before this fires,
+		// but poll the socket just in case.
+		_sendTimer->start(DelayBetweenMessages);
+	}
 
-	_socket->write(data);
+	if (busy()) {
+		blockFrame();
+	} else {
+		unblockFrame();
+	}
 }
 
-void MetaWatch::realReceive(bool block)
+char * MetaWatch::writeLcdLine(Mode mode, int line, char *dst)
 {
-	do {
-		qint64 dataRead;
+	const QImage& image = _image[mode];
+	const int rowSize = image.width() / 8;
+	const char *scanLine = reinterpret_cast<const char*>(image.constScanLine(line));
 
-#if PROTOCOL_DEBUG
-		qDebug() << "received" << _socket->bytesAvailable() << "bytes";
-#endif
+	Q_ASSERT(rowSize == 12);
 
-		if (_partialReceived.type == 0) {
-			/* Still not received even the packet type */
-			/* Receive the full header, 4 bytes. */
-			if (_socket->bytesAvailable() < 4 && !block) {
-				/* Still not enough data available. */
-				return; /* Wait for more, if non blocking. */
-			}
-			static const int HEADER_SIZE = 4;
-			char header[HEADER_SIZE];
+	*dst++ = line;
+	memcpy(dst, scanLine, rowSize);
 
-			dataRead = _socket->read(header, HEADER_SIZE);
-#if PROTOCOL_DEBUG
-			qDebug() << "received" << QByteArray(header, HEADER_SIZE).toHex();
-#endif
-			if (dataRead < 4) {
-				qWarning() << "Short read";
-				return;
-			} else if (header[0] != 0x01 || header[1] > 32) {
-				qWarning() << "Header not found, trying to recover";
-				// Let's try to find the header in one of the four bits we read
-				for (int i = 1; i < HEADER_SIZE; i++) {
-					if (header[i] == 0x01) {
-						// Header possibly found, try to recover by pushing
-						// the partial header back into the buffer and retrying
-						for (int j = HEADER_SIZE - 1; j >= i; j--) {
-							_socket->ungetChar(header[j]);
-						}
-					}
-				}
-				// In any case, try to repeat.
-				continue;
-			}
+	// This is now what the watch will have in its buffer
+	memcpy(_shadow[mode].data() + line * rowSize, scanLine, rowSize);
+	_shadowValid[mode].setBit(line);
 
-			_partialReceived.type = static_cast<MessageType>(header[2]);
-			_partialReceived.data.resize(header[1] - 6);
-			_partialReceived.options = header[3];
-#if PROTOCOL_DEBUG
-			qDebug() << "got header";
-#endif
-		}
+	return dst + rowSize;
+}
 
-		/* We have the header; now, try to get the complete packet. */
-		if (_socket->bytesAvailable() < (_partialReceived.data.size() + 2) &&
-			!block) {
-			return; /* Wait for more. */
+void MetaWatch::realSend(const Message &msg)
+{
+	const int size = frameSize(msg);
+	char frame[MaxFrameSize];
+	char *p = &frame[4];
+	quint16 crc;
+
+	Q_ASSERT(_connected && _socket);
+	Q_ASSERT(size <= MaxFrameSize);
+
+	frame[0] = 0x01;
+	frame[1] = size;
+	frame[2] = msg.type;
+	frame[3] = msg.options;
+
+	if (msg.lineA >= 0) {
+		const Mode mode = static_cast<Mode>(msg.options & 0x3);
+		p = writeLcdLine(mode, msg.lineA, p);
+		if (msg.lineB >= 0) {
+			p = writeLcdLine(mode, msg.lineB, p);
 		}
-		dataRead = _socket->read(_partialReceived.data.data(), _partialReceived.data.size());
-		if (dataRead < _partialReceived.data.size()) {
-			qWarning() << "Short read";
-			return;
+	} else {
+		memcpy(p, msg.data.constData(), msg.data.size());
+		p += msg.data.size();
+		if (msg.type == LoadLcdTemplate) {
+			// From now on, the watch has the template in this buffer.
+			fillShadow(static_cast<Mode>(msg.options & 0x3), msg.data[0]);
 		}
+	}
 
-		char tail[2];
-		dataRead = _socket->read(tail, 2);
-		if (dataRead < 2) {
-			qWarning() << "Short read";
-			return;
-		}
+	crc = MetaWatchCrc::calculate(frame, size - 2);
+	p[0] = crc & 0xFF;
+	p[1] = crc >> 8;
 
-		quint16 realCrc = calcCrc(_partialReceived);
-		quint16 expectedCrc = tail[1] << 8 | (tail[0] & 0xFFU);
-		if (realCrc == expectedCrc) {
 #if PROTOCOL_DEBUG
-			qDebug() << "received" << _partialReceived.type << _partialReceived.options
-			         << _partialReceived.data.toHex();
+	qDebug() << "sending" << QByteArray(frame, size).toHex();
 #endif
-			handleMessage(_partialReceived);
-		} else {
-			qWarning() << "CRC error?";
-		}
 
-		// Prepare for the next packet
-		_partialReceived.data.clear();
-		_partialReceived.type = NoMessage;
-	} while (_socket->bytesAvailable() > 0 && !block);
-	// Loop until there are no more messages, or we are blocking and have received one.
+	if (!_linkSample.isValid()) {
+		// Link was idle, start a new throughput sample
+		_linkSampleBytes = 0;
+		_linkSample.start();
+	}
+
+	_socket->write(frame, size);
 }
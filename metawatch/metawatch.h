@@ -2,13 +2,18 @@
 #define METAWATCH_H
 
 #include <QtCore/QQueue>
+#include <QtCore/QHash>
+#include <QtCore/QBitArray>
+#include <QtCore/QVarLengthArray>
 #include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
 #include <QtConnectivity/QBluetoothAddress>
 #include <QtConnectivity/QBluetoothSocket>
 #include <QtConnectivity/QBluetoothLocalDevice>
 #include <QtSystemInfo/QSystemAlignedTimer>
 #include <sowatch.h>
 #include <sowatchbt.h>
+#include "metawatchframeparser.h"
 
 namespace sowatch
 {
@@ -28,7 +33,18 @@ public:
 	explicit MetaWatch(ConfigKey *settings, QObject *parent = 0);
 	~MetaWatch();
 
+	/** Time between polls of the socket when it does not report bytesWritten(). */
 	static const int DelayBetweenMessages = 5;
+	/** Maximum amount of bytes we allow to sit in the socket's write buffer. */
+	static const int MaxBytesToWrite = 128;
+	/** Initial estimate of the link throughput, in bytes per second. */
+	static const int InitialLinkThroughput = 6000;
+	/** Minimum time a throughput sample has to cover before it is accounted. */
+	static const int LinkSampleTime = 100;
+	/** The watch is considered busy if the queue takes longer than this (msecs) to drain. */
+	static const int MaxQueueDrainTime = 50;
+	/** Maximum size of a frame, as the length field is a single byte. */
+	static const int MaxFrameSize = 255;
 
 	static const int VibrateLength = 500;
 	static const int DelayBetweenRings = 2500;
@@ -101,6 +117,18 @@ public:
 	QStringList buttons() const;
 
 	bool busy() const;
+	int drainTime() const;
+
+	/** Measured throughput of the link to the watch, in bytes per second. */
+	int linkThroughput() const;
+	/** Bytes that are waiting to be sent to the watch, either in the queue or in the socket. */
+	int queuedBytes() const;
+	/** Estimated time (in msecs) until all queued bytes have been sent. */
+	int queueDrainTime() const;
+	/** Number of queued messages that were superseded by newer ones before being sent. */
+	uint supersededMessages() const;
+	/** Bytes that were not sent over the air because their messages were superseded. */
+	uint supersededBytes() const;
 
 	void setDateTime(const QDateTime& dateTime);
 	void queryDateTime();
@@ -113,7 +141,7 @@ public:
 	bool charging() const;
 
 	void displayIdleScreen();
-	void displayNotification(Notification *notification);
+	void displayNotification(Notification *notification, bool alert);
 	void displayApplication();
 
 	void vibrate(int msecs);
@@ -125,7 +153,8 @@ public:
 	QRect rectFor(Mode mode);
 
 	virtual void clear(Mode mode, bool black = false) = 0;
-	virtual void update(Mode mode, const QList<QRect>& rects = QList<QRect>()) = 0;
+	/** Sends the damaged rows of a mode's framebuffer to the watch. */
+	virtual void update(Mode mode, const QBitArray& rows = QBitArray()) = 0;
 	void grabButton(Mode mode, Button button);
 	void ungrabButton(Mode mode, Button button);
 
@@ -135,8 +164,24 @@ protected:
 		MessageType type;
 		quint8 options;
 		QByteArray data;
+		/** For WriteLcdBuffer messages without data, the rows whose contents
+		 *  are to be taken from the mode framebuffer when the message is sent. */
+		short lineA, lineB;
 		Message(MessageType ntype = NoMessage, QByteArray ndata = QByteArray(), quint8 noptions = 0) :
-			type(ntype), options(noptions), data(ndata)
+			type(ntype), options(noptions), data(ndata), lineA(-1), lineB(-1)
+		{ }
+	};
+
+	/** The messages needed to update a mode buffer in the watch. */
+	struct UploadPlan {
+		/** Template to load before writing rows, or -1 if none. */
+		int templ;
+		/** Rows to write, in ascending order. */
+		QVarLengthArray<int, 96> lines;
+		/** Cost of the plan (not including UpdateLcdDisplay). */
+		int packets;
+		int bytes;
+		UploadPlan() : templ(-1), packets(0), bytes(0)
 		{ }
 	};
 
@@ -176,26 +221,67 @@ protected:
 
 	/** The framebuffers for each of the watch modes */
 	QImage _image[3];
-
-	/** The "packets to be sent" asynchronous queue **/
+	/** A copy of the rows that have been sent to each of the watch's mode buffers. */
+	QByteArray _shadow[3];
+	/** Which rows of the shadow buffers are known to match the watch contents. */
+	QBitArray _shadowValid[3];
+	/** Template to load into each mode buffer before the next update,
+	 *  or -1 if none. Loading is delayed until the update, since there is
+	 *  no need to clear the buffer if the new contents match the old ones. */
+	int _pendingTemplate[3];
+	/** Whether the watch is showing the current contents of the buffer
+	 *  for the current mode. */
+	bool _displayUpToDate;
+	/** Number of updates that did not need to send anything because the
+	 *  watch buffer already had the same contents. */
+	uint _skippedUpdates;
+	/** Statistics about the cost of the updates sent. */
+	uint _uploadPackets;
+	uint _uploadBytes;
+
+	/** The "packets to be sent" asynchronous queue.
+	 *  Superseded messages are left in place with type NoMessage. **/
 	QQueue<Message> _toSend;
+	/** Sequence number of the message at the head of _toSend. */
+	uint _toSendHead;
+	/** Maps a message key to the sequence number of the last queued message with that key. */
+	QHash<quint32, uint> _toSendIndex;
+	/** Sequence number of the last LoadLcdTemplate queued for each mode. */
+	uint _toSendLastTemplate[3];
+	/** Total size of the frames in _toSend, in bytes. */
+	int _toSendBytes;
 	QTimer* _sendTimer;
-	Message _partialReceived;
+	/** Statistics about superseded messages. */
+	uint _supersededMessages;
+	uint _supersededBytes;
+
+	// Link throughput estimation
+	/** Current estimate of the link throughput, in bytes per second. */
+	int _linkThroughput;
+	/** Bytes written by the socket during the current sample. */
+	qint64 _linkSampleBytes;
+	/** Measures the duration of the current sample; invalid if the link is idle. */
+	QElapsedTimer _linkSample;
+	/** Splits the received bytes into messages. */
+	MetaWatchFrameParser _parser;
 
 	// Watch connect/disconnect handling
 	void setupBluetoothWatch();
 	void desetupBluetoothWatch();
 
 	// Message passing
-	/** Used to calculate CRC fields in message header */
-	static const quint8 bitRevTable[16];
-	static const quint16 crcTable[256];
-	static quint16 calcCrc(const QByteArray& data, int size);
-	static quint16 calcCrc(const Message& msg);
-
-	/** Sends a message to the watch. Does not block. */
+	/** Size of the complete frame (header, payload and CRC) for a message. */
+	static int frameSize(const Message& msg);
+	/** Key identifying messages that can supersede each other,
+	 *  made of the message type, and the mode and rows it affects. */
+	static quint32 messageKey(const Message& msg);
+
+	/** Sends a message to the watch. Does not block.
+	 *  A queued message with the same key that has not been sent yet might
+	 *  be superseded by this one (e.g. writes to the same LCD row).
+	 */
 	virtual void send(const Message& msg);
-	/** Sends a message to the watch if a message of the same type is not
+	/** Sends a message to the watch if a message with the same key is not
 	 *  already queued. Does not block.
 	 */
 	void sendIfNotQueued(const Message& msg);
@@ -203,9 +289,8 @@ protected:
 	/* Some functions that wrap sending some watch messages. */
 	void updateWatchProperties();
 	void setVibrateMode(bool enable, uint on, uint off, uint cycles);
-	void updateLcdLine(Mode mode, const QImage& image, int line);
-	void updateLcdLines(Mode mode, const QImage& image, int lineA, int lineB);
-	void updateLcdLines(Mode mode, const QImage& image, const QVector<bool>& lines);
+	void updateLcdLine(Mode mode, int line);
+	void updateLcdLines(Mode mode, int lineA, int lineB);
 	void configureLcdIdleSystemArea(bool entireScreen);
 	void updateLcdDisplay(Mode mode, int startRow = 0, int numRows = 0);
 	void loadLcdTemplate(Mode mode, int templ);
@@ -213,6 +298,23 @@ protected:
 	void enableButton(Mode mode, Button button, ButtonPress press);
 	void disableButton(Mode mode, Button button, ButtonPress press);
 
+	/** Forget what we know about the contents of a mode buffer in the watch. */
+	void invalidateShadow(Mode mode);
+	/** Record that a mode buffer in the watch now contains a template. */
+	void fillShadow(Mode mode, int templ);
+	/** Returns true if a row of a mode framebuffer is different from what
+	 *  was last sent to the watch. */
+	bool lineChanged(Mode mode, int line) const;
+	/** Returns true if a row of a mode framebuffer is what loading a
+	 *  template (0 for white, 1 for black) would leave in it. */
+	bool lineMatchesTemplate(Mode mode, int line, int templ) const;
+
+	/** Decides how to bring the watch buffer for a mode up to date with
+	 *  its framebuffer, given the rows that were damaged. */
+	UploadPlan planUpload(Mode mode, const QBitArray& lines) const;
+	/** Queues the messages of an upload plan. */
+	void sendUpload(Mode mode, const UploadPlan& plan);
+
 	void handleMessage(const Message& msg);
 	void handleDeviceTypeMessage(const Message& msg);
 	void handleRealTimeClockMessage(const Message& msg);
@@ -224,12 +326,16 @@ protected:
 private slots:
 	void settingChanged(const QString& key);
 	void dataReceived();
+	void dataWritten(qint64 bytes);
 	void timedSend();
 	void timedRing();
 
 private:
+	void supersedeQueued(uint seq);
+	void sendFromQueue();
+	/** Serializes a row of a mode framebuffer into a WriteLcdBuffer payload. */
+	char * writeLcdLine(Mode mode, int line, char *dst);
 	void realSend(const Message& msg);
-	void realReceive(bool block);
 };
 
 }
@@ -14,6 +14,8 @@ MOBILITY += connectivity systeminfo
 SOURCES += metawatchplugin.cpp \
     metawatchpaintengine.cpp \
     metawatch.cpp \
+    metawatchcrc.cpp \
+    metawatchframeparser.cpp \
     metawatchdigital.cpp \
     metawatchanalog.cpp \
     metawatchscanner.cpp \
@@ -23,6 +25,8 @@ SOURCES += metawatchplugin.cpp \
 HEADERS += metawatchplugin.h \
     metawatchpaintengine.h \
     metawatch.h \
+    metawatchcrc.h \
+    metawatchframeparser.h \
     metawatchdigital.h \
     metawatchanalog.h \
     metawatchscanner.h \
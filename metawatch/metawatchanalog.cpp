@@ -61,7 +61,7 @@ void MetaWatchAnalog::displayIdleScreen()
 	MetaWatch::displayIdleScreen();
 }
 
-void MetaWatchAnalog::displayNotification(Notification *n)
+void MetaWatchAnalog::displayNotification(Notification *n, bool alert)
 {
 	qDebug() << "display notification" << n->title() << n->body();
 
@@ -69,7 +69,7 @@ void MetaWatchAnalog::displayNotification(Notification *n)
 	_currentMode = NotificationMode;
 	// TODO
 
-	MetaWatch::displayNotification(n);
+	MetaWatch::displayNotification(n, alert);
 }
 
 void MetaWatchAnalog::displayApplication()
@@ -79,11 +79,11 @@ void MetaWatchAnalog::displayApplication()
 	MetaWatch::displayApplication();
 }
 
-void MetaWatchAnalog::update(Mode mode, const QList<QRect> &rects)
+void MetaWatchAnalog::update(Mode mode, const QBitArray& rows)
 {
 	if (!_connected) return;
 	Q_UNUSED(mode);
-	Q_UNUSED(rects);
+	Q_UNUSED(rows);
 	// TODO
 }
 
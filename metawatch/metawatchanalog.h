@@ -23,11 +23,11 @@ public:
 	void updateWeather(WeatherNotification *weather);
 
 	void displayIdleScreen();
-	void displayNotification(Notification *notification);
+	void displayNotification(Notification *notification, bool alert);
 	void displayApplication();
 
 	void clear(Mode mode, bool black = false);
-	void update(Mode mode, const QList<QRect>& rects = QList<QRect>());
+	void update(Mode mode, const QBitArray& rows = QBitArray());
 
 protected:
 	void setupBluetoothWatch();
@@ -0,0 +1,42 @@
+#ifndef METAWATCHCRC_H
+#define METAWATCHCRC_H
+
+#include <QtCore/QtGlobal>
+
+namespace sowatch
+{
+
+/** Incremental calculator for the CRC used in MetaWatch protocol frames.
+ *  The MetaWatch uses CRC-CCITT (initial value 0xFFFF) over bit-reversed
+ *  bytes; this computes the same CRC using the reflected form of the
+ *  algorithm, which does not need to reverse each byte.
+ */
+class MetaWatchCrc
+{
+public:
+	MetaWatchCrc();
+
+	/** Accumulates a single byte into the CRC. */
+	void update(quint8 byte);
+	/** Accumulates a range of bytes into the CRC. */
+	void update(const char *data, int size);
+
+	/** The CRC of all the bytes accumulated so far. */
+	quint16 value() const;
+
+	/** Calculates the CRC of a single range of bytes. */
+	static quint16 calculate(const char *data, int size);
+
+private:
+	static const quint16 table[256];
+	quint16 _crc;
+};
+
+inline void MetaWatchCrc::update(quint8 byte)
+{
+	_crc = (_crc >> 8) ^ table[(_crc ^ byte) & 0xFF];
+}
+
+}
+
+#endif // METAWATCHCRC_H
@@ -53,10 +53,10 @@ void MetaWatchDigital::displayIdleScreen()
 	updateLcdDisplay(IdleMode);
 }
 
-void MetaWatchDigital::displayNotification(Notification *n)
+void MetaWatchDigital::displayNotification(Notification *n, bool alert)
 {
 	qDebug() << "entering notification mode";
-	MetaWatch::displayNotification(n);
+	MetaWatch::displayNotification(n, alert);
 }
 
 void MetaWatchDigital::displayApplication()
@@ -68,25 +68,30 @@ void MetaWatchDigital::displayApplication()
 void MetaWatchDigital::clear(Mode mode, bool black)
 {
 	if (!_connected) return;
-	loadLcdTemplate(mode, black ? 1 : 0);
+	// Will be sent during the following update(), if still needed.
+	_pendingTemplate[mode] = black ? 1 : 0;
 }
 
-void MetaWatchDigital::update(Mode mode, const QList<QRect> &rects)
+void MetaWatchDigital::update(Mode mode, const QBitArray& rows)
 {
 	if (!_connected) return;
-	const QRect clipRect(0, 0, screenWidth, screenHeight);
-	QVector<bool> lines(screenHeight, false);
 
-	foreach (const QRect& rect, rects) {
-		QRect r = rect.intersect(clipRect);
-		for (int i = r.top(); i <= r.bottom(); i++) {
-			lines[i] = true;
-		}
-	}
+	const UploadPlan plan = planUpload(mode, rows);
+	sendUpload(mode, plan);
+	_pendingTemplate[mode] = -1;
 
-	updateLcdLines(mode, _image[mode], lines);
+	if (plan.packets == 0) {
+		_skippedUpdates++;
+	}
 	if (mode == _currentMode) {
-		updateLcdDisplay(mode);
+		if (!_displayUpToDate || plan.templ >= 0) {
+			updateLcdDisplay(mode);
+		} else if (!plan.lines.isEmpty()) {
+			// Only refresh the rows that were written.
+			const int first = plan.lines[0];
+			const int last = plan.lines[plan.lines.size() - 1];
+			updateLcdDisplay(mode, first, last - first + 1);
+		}
 	}
 }
 
@@ -21,11 +21,11 @@ public:
 	QString model() const;
 
 	void displayIdleScreen();
-	void displayNotification(Notification *notification);
+	void displayNotification(Notification *notification, bool alert);
 	void displayApplication();
 
 	void clear(Mode mode, bool black = false);
-	void update(Mode mode, const QList<QRect>& rects = QList<QRect>());
+	void update(Mode mode, const QBitArray& rows = QBitArray());
 
 protected:
 	void setupBluetoothWatch();
@@ -11,7 +11,8 @@ using namespace sowatch;
 MetaWatchDigitalSimulator::MetaWatchDigitalSimulator(ConfigKey *config, QObject *parent) :
 	MetaWatchDigital(config, parent),
 	_form(new MetaWatchDigitalSimulatorForm),
-	_nextFrame(QTime::currentTime())
+	_nextFrame(QTime::currentTime()),
+	_frameTimer(new QTimer(this))
 {
 	_pixmap[IdleMode] = QPixmap(screenWidth, screenHeight);
 	_pixmap[ApplicationMode] = QPixmap(screenWidth, screenHeight);
@@ -23,6 +24,9 @@ MetaWatchDigitalSimulator::MetaWatchDigitalSimulator(ConfigKey *config, QObject
 	connect(_form, SIGNAL(buttonPressed(int)), SLOT(handleButtonPressed(int)));
 	connect(_form, SIGNAL(destroyed()), SLOT(handleFormDestroyed()));
 
+	_frameTimer->setSingleShot(true);
+	connect(_frameTimer, SIGNAL(timeout()), SLOT(handleFrameSent()));
+
 	// Show the form
 	_form->showNormal();
 
@@ -45,15 +49,24 @@ bool MetaWatchDigitalSimulator::busy() const
 #endif
 }
 
+int MetaWatchDigitalSimulator::drainTime() const
+{
+#if SIMULATE_FRAMERATE
+	return qMax(0, QTime::currentTime().msecsTo(_nextFrame));
+#else
+	return 0;
+#endif
+}
+
 void MetaWatchDigitalSimulator::displayIdleScreen()
 {
 	MetaWatchDigital::displayIdleScreen();
 	_form->refreshScreen(_pixmap[_currentMode]);
 }
 
-void MetaWatchDigitalSimulator::displayNotification(Notification *notification)
+void MetaWatchDigitalSimulator::displayNotification(Notification *notification, bool alert)
 {
-	MetaWatchDigital::displayNotification(notification);
+	MetaWatchDigital::displayNotification(notification, alert);
 	_form->refreshScreen(_pixmap[_currentMode]);
 }
 
@@ -71,21 +84,18 @@ void MetaWatchDigitalSimulator::clear(Mode mode, bool black)
 	}
 }
 
-void MetaWatchDigitalSimulator::update(Mode mode, const QList<QRect> &rects)
+void MetaWatchDigitalSimulator::update(Mode mode, const QBitArray& rows)
 {
 #if SIMULATE_DAMAGES
 	const QRect imageRect = _image[mode].rect();
 	QPainter p;
-	QVector<bool> rows(96, false);
 
 	p.begin(&_pixmap[mode]);
-	foreach (const QRect& rect, rects) {
-		QRect r = rect.intersect(imageRect);
-		for (int i = r.top(); i <= r.bottom(); i++) {
-			rows[i] = true;
+	for (int i = 0; i < qMin(rows.size(), imageRect.height()); i++) {
+		if (rows.testBit(i)) {
+			QRect r(0, i, imageRect.width(), 1);
+			p.drawImage(r, _image[mode], r);
 		}
-
-		p.drawImage(r, _image[mode], r);
 	}
 
 	if (mode == IdleMode) {
@@ -101,9 +111,13 @@ void MetaWatchDigitalSimulator::update(Mode mode, const QList<QRect> &rects)
 	qDebug() << "updated" << totalRows << "lines";
 	_nextFrame = QTime::currentTime().addMSecs(((totalRows / 2) + 1) * DelayBetweenMessages);
 #else
-	Q_UNUSED(rects);
+	Q_UNUSED(rows);
 	_pixmap[mode] = QPixmap::fromImage(_image[mode]);
 	_nextFrame = QTime::currentTime().addMSecs(DelayBetweenMessages);
+#endif
+#if SIMULATE_FRAMERATE
+	blockFrame();
+	_frameTimer->start(drainTime());
 #endif
 	if (mode == _currentMode) {
 		_form->refreshScreen(_pixmap[mode]);
@@ -154,3 +168,8 @@ void MetaWatchDigitalSimulator::handleButtonPressed(int button)
 		emit nextWatchletRequested();
 	}
 }
+
+void MetaWatchDigitalSimulator::handleFrameSent()
+{
+	unblockFrame();
+}
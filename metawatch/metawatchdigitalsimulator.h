@@ -2,6 +2,7 @@
 #define METAWATCHSIMULATOR_H
 
 #include <QtCore/QTime>
+#include <QtCore/QTimer>
 #include <QtGui/QPixmap>
 #include "metawatchdigital.h"
 #include "metawatchdigitalsimulatorform.h"
@@ -16,13 +17,14 @@ public:
 	~MetaWatchDigitalSimulator();
 
 	bool busy() const;
+	int drainTime() const;
 
 	void displayIdleScreen();
-	void displayNotification(Notification *notification);
+	void displayNotification(Notification *notification, bool alert);
 	void displayApplication();
 
 	void clear(Mode mode, bool black);
-	void update(Mode mode, const QList<QRect> &rects);
+	void update(Mode mode, const QBitArray& rows);
 
 	void vibrate(bool on);
 
@@ -32,11 +34,14 @@ public:
 private slots:
 	void handleFormDestroyed();
 	void handleButtonPressed(int button);
+	void handleFrameSent();
 
 private:
 	MetaWatchDigitalSimulatorForm* _form;
 	QPixmap _pixmap[3];
 	QTime _nextFrame;
+	/** Fires once the simulated link would have sent the last frame. */
+	QTimer* _frameTimer;
 };
 
 }
@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include "metawatchcrc.h"
+#include "metawatchframeparser.h"
+
+using namespace sowatch;
+
+MetaWatchFrameParser::MetaWatchFrameParser()
+	: _pos(0), _droppedBytes(0), _crcErrors(0)
+{
+}
+
+void MetaWatchFrameParser::append(const char *data, int size)
+{
+	if (_pos > 0) {
+		// Discard the already parsed bytes; this invalidates
+		// all the frames returned so far.
+		_buffer.remove(0, _pos);
+		_pos = 0;
+	}
+	_buffer.append(data, size);
+}
+
+void MetaWatchFrameParser::clear()
+{
+	_buffer.clear();
+	_pos = 0;
+}
+
+bool MetaWatchFrameParser::next(Frame *frame)
+{
+	const char *buffer = _buffer.constData();
+	const int size = _buffer.size();
+
+	while (_pos < size) {
+		const char *p = buffer + _pos;
+		const int avail = size - _pos;
+
+		if (*p != 0x01) {
+			// Not at the start of a frame, look for the next one.
+			const char *start = static_cast<const char*>(memchr(p, 0x01, avail));
+			const int skip = start ? start - p : avail;
+			_droppedBytes += skip;
+			_pos += skip;
+			continue;
+		}
+
+		if (avail < 2) {
+			return false; // Wait for the length byte
+		}
+
+		const int length = static_cast<quint8>(p[1]);
+		if (length < MinFrameSize) {
+			// Cannot be a frame start, skip this byte.
+			_droppedBytes++;
+			_pos++;
+			continue;
+		}
+
+		if (avail < length) {
+			// This might be a false start byte with a bogus length;
+			// if a complete frame follows it, then it must have been.
+			const char *q = findFrame(p + 1, avail - 1);
+			if (q) {
+				_droppedBytes += q - p;
+				_pos += q - p;
+				continue;
+			}
+			return false; // Wait for the rest of the frame
+		}
+
+		if (!isValidFrame(p, length)) {
+			// Either a corrupted frame or a false start byte;
+			// try again from the next byte.
+			_crcErrors++;
+			_droppedBytes++;
+			_pos++;
+			continue;
+		}
+
+		frame->type = p[2];
+		frame->options = p[3];
+		frame->data = p + 4;
+		frame->size = length - MinFrameSize;
+
+		_pos += length;
+
+		return true;
+	}
+
+	return false;
+}
+
+bool MetaWatchFrameParser::isValidFrame(const char *p, int length)
+{
+	const quint16 realCrc = MetaWatchCrc::calculate(p, length - 2);
+	const quint16 expectedCrc = static_cast<quint8>(p[length - 2]) |
+	        (static_cast<quint8>(p[length - 1]) << 8);
+	return realCrc == expectedCrc;
+}
+
+const char * MetaWatchFrameParser::findFrame(const char *p, int size)
+{
+	const char *end = p + size;
+	while ((p = static_cast<const char*>(memchr(p, 0x01, end - p)))) {
+		if (end - p >= MinFrameSize) {
+			const int length = static_cast<quint8>(p[1]);
+			if (length >= MinFrameSize && end - p >= length &&
+			        isValidFrame(p, length)) {
+				return p;
+			}
+		}
+		p++;
+	}
+	return 0;
+}
+
+int MetaWatchFrameParser::pendingBytes() const
+{
+	return _buffer.size() - _pos;
+}
+
+uint MetaWatchFrameParser::droppedBytes() const
+{
+	return _droppedBytes;
+}
+
+uint MetaWatchFrameParser::crcErrors() const
+{
+	return _crcErrors;
+}
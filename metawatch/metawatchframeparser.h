@@ -0,0 +1,63 @@
+#ifndef METAWATCHFRAMEPARSER_H
+#define METAWATCHFRAMEPARSER_H
+
+#include <QtCore/QByteArray>
+
+namespace sowatch
+{
+
+/** Splits a stream of bytes received from a MetaWatch into protocol frames.
+ *  It does not depend on the socket, so it can be fed arbitrary byte streams.
+ *  Garbage, truncated frames and frames with a bad CRC are skipped by
+ *  looking for the next start byte.
+ */
+class MetaWatchFrameParser
+{
+public:
+	MetaWatchFrameParser();
+
+	/** A frame inside the receive buffer. */
+	struct Frame {
+		quint8 type;
+		quint8 options;
+		/** Payload of the frame; it points into the receive buffer, so it is
+		 *  only valid until the next call to append() or clear(). */
+		const char *data;
+		int size;
+	};
+
+	static const int MinFrameSize = 6;
+
+	/** Adds received bytes to the end of the receive buffer. */
+	void append(const char *data, int size);
+	/** Drops all the buffered bytes. */
+	void clear();
+
+	/** Extracts the next valid frame from the receive buffer.
+	 *  Returns false if there is not a complete frame available yet. */
+	bool next(Frame *frame);
+
+	/** Number of received bytes that have not been parsed yet; once next()
+	 *  returns false, this is always less than the maximum frame size. */
+	int pendingBytes() const;
+
+	/** Number of bytes that have been discarded while resynchronizing. */
+	uint droppedBytes() const;
+	/** Number of frames that have been discarded because of a bad CRC. */
+	uint crcErrors() const;
+
+private:
+	static bool isValidFrame(const char *p, int length);
+	/** Finds the first complete and valid frame in a range of bytes. */
+	static const char * findFrame(const char *p, int size);
+
+	QByteArray _buffer;
+	/** Position of the first byte in _buffer that has not been parsed yet. */
+	int _pos;
+	uint _droppedBytes;
+	uint _crcErrors;
+};
+
+}
+
+#endif // METAWATCHFRAMEPARSER_H
@@ -4,8 +4,13 @@
 using namespace sowatch;
 
 MetaWatchPaintEngine::MetaWatchPaintEngine()
-    : WatchPaintEngine()
+    : WatchPaintEngine(), _rowDamage(new RowDamage)
 {
+	// The watch is updated a row at a time.
+	setDamageAccumulator(_rowDamage);
+	// Comparing a 1bpp frame buffer is cheap, and it avoids
+	// sending rows that did not actually change.
+	setDamageMode(PixelDiffDamage);
 }
 
 bool MetaWatchPaintEngine::begin(QPaintDevice *pdev)
@@ -20,7 +25,7 @@ bool MetaWatchPaintEngine::end()
 {
 	bool ret = WatchPaintEngine::end();
 	if (ret) {
-		_watch->update(_mode, _damaged.rects().toList());
+		_watch->update(_mode, _rowDamage->rows());
 	}
 	return ret;
 }
@@ -32,7 +37,7 @@ void MetaWatchPaintEngine::drawRects(const QRectF *rects, int rectCount)
 		const QRectF& r = rects[i];
 		if (_hasBrush && fillsEntireImage(r.toRect()) && (_isBrushBlack | _isBrushWhite)) {
 			_watch->clear(_mode, _isBrushBlack);
-			_damaged = QRegion();
+			discardDamage(_isBrushBlack ? Qt::black : Qt::white);
 			continue;
 		}
 		if (_hasBrush) {
@@ -55,7 +60,7 @@ void MetaWatchPaintEngine::drawRects(const QRect *rects, int rectCount)
 		const QRect& r = rects[i];
 		if (_hasBrush && fillsEntireImage(r) && (_isBrushBlack | _isBrushWhite)) {
 			_watch->clear(_mode, _isBrushBlack);
-			_damaged = QRegion();
+			discardDamage(_isBrushBlack ? Qt::black : Qt::white);
 			continue;
 		}
 		if (_hasBrush) {
@@ -26,6 +26,7 @@ protected:
 
 	MetaWatch* _watch;
 	MetaWatch::Mode _mode;
+	RowDamage* _rowDamage;
 	bool _isBrushBlack;
 	bool _isBrushWhite;
 };
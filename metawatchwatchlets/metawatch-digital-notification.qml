@@ -6,9 +6,11 @@ MWPage {
 	id: page
 
 	property QtObject curNotification: null;
+	property int collapsedCount: 0;
 
 	MWTitle {
 		id: title
+		text: collapsedCount > 0 ? "+" + collapsedCount + " more" : ""
 	}
 
 	MWScrollable {
@@ -138,9 +140,10 @@ MWPage {
 		return false;
 	}
 
-	function openNotification(notification) {
+	function openNotification(notification, collapsed) {
 		scrollable.scrollTop();
 		curNotification = notification;
+		collapsedCount = collapsed;
 	}
 
 	Connections {
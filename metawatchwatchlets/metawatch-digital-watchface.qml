@@ -158,6 +158,7 @@ MWPage {
 
 	Connections {
 		target: notifications
-		onModelChanged: update();
+		onModelChanged: updateWeather();
+		onCountsChanged: updateUnreadCounts();
 	}
 }
@@ -6,6 +6,7 @@
 #include <QtLocation/QGeoMappingManager>
 #include <QtLocation/QGeoPositionInfoSource>
 #include <QtLocation/QGeoSearchReply>
+#include <sowatch.h>
 
 namespace sowatch
 {
@@ -67,6 +68,10 @@ private slots:
 private:
 	bool _enabled;
 	bool _decolor;
+	MonoConverter _monoConverter;
+	/** Buffers used to convert the map when decolor is set. */
+	QImage _colorImage;
+	QImage _monoImage;
 	QImage _arrow;
 	QGeoMapData *_mapData;
 	QGeoPositionInfoSource *_posSource;
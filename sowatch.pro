@@ -77,6 +77,13 @@ contains(MEEGO_EDITION,harmattan) {
 	qmafwwatchlet.depends = libsowatch
 }
 
+# Unit tests and benchmarks; these depend on QtTest.
+# Build them with "qmake CONFIG+=tests".
+CONFIG(tests) {
+	SUBDIRS += tests
+	tests.depends = libsowatch libsowatchbt
+}
+
 # Debug only watchlets
 CONFIG(debug, debug|release) {
 	SUBDIRS += testnotification
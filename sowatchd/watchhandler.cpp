@@ -73,6 +73,9 @@ WatchHandler::WatchHandler(ConfigKey *config, QObject *parent)
 		}
 	}
 
+	_server->setNotificationBatchInterval(_config->value("notification-batch-interval", 0).toInt());
+	updateRateLimits();
+
 	updateProviders();
 	updateWatchlets();
 }
@@ -99,6 +102,13 @@ Watchlet* WatchHandler::createWatchlet(const QString &id)
 
 	ConfigKey *subconfig = _config->getSubkey(id);
 	Watchlet* watchlet = plugin->getWatchlet(id, subconfig, _watch);
+
+	// Let graphical watchlets follow their render budget settings
+	GraphicsWatchlet *graphicsWatchlet = qobject_cast<GraphicsWatchlet*>(watchlet);
+	if (graphicsWatchlet) {
+		graphicsWatchlet->setSettings(subconfig);
+	}
+
 	delete subconfig;
 
 	return watchlet;
@@ -116,6 +126,16 @@ void WatchHandler::deleteWatchletAt(int index)
 	delete watchlet;
 }
 
+void WatchHandler::updateRateLimits()
+{
+	_server->setNotificationRateLimit(_config->value("notification-rate-limit", 0).toInt(),
+	                                  _config->value("notification-rate-burst", 5).toInt());
+	_server->setNotificationTypeRateLimit(_config->value("notification-type-rate-limit", 0).toInt(),
+	                                      _config->value("notification-type-rate-burst", 3).toInt());
+	_server->setVibrationBudget(_config->value("vibration-budget", 0).toInt(),
+	                            _config->value("vibration-budget-burst", 3).toInt());
+}
+
 void WatchHandler::updateWatchlets()
 {
 	if (!_server) return;
@@ -223,6 +243,12 @@ void WatchHandler::handleConfigSubkeyChanged(const QString &subkey)
 		} else {
 			_server->setIdleWatchlet(0);
 		}
+	} else if (subkey == "notification-batch-interval" && _server) {
+		_server->setNotificationBatchInterval(_config->value("notification-batch-interval", 0).toInt());
+	} else if ((subkey.startsWith("notification-rate-") ||
+	            subkey.startsWith("notification-type-rate-") ||
+	            subkey.startsWith("vibration-budget")) && _server) {
+		updateRateLimits();
 	} else if (subkey == "notification-watchlet" && _server) {
 		qDebug() << "Notification watchlet changed";
 		QString id(_config->value("notification-watchlet").toString());
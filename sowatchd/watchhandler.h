@@ -25,6 +25,7 @@ signals:
 private:
 	Watchlet* createWatchlet(const QString& id);
 	void deleteWatchletAt(int index);
+	void updateRateLimits();
 
 private slots:
 	void updateWatchlets();
@@ -0,0 +1,12 @@
+TARGET = tst_liveviewtileencoder
+CONFIG += qtestlib testcase
+QT += gui
+
+SOURCES += tst_liveviewtileencoder.cpp \
+    ../../liveview/liveviewtileencoder.cpp
+
+HEADERS += ../../liveview/liveviewtileencoder.h
+
+INCLUDEPATH += $$PWD/../../liveview
+
+LIBS += -lz
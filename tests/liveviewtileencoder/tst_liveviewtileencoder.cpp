@@ -0,0 +1,189 @@
+#include <QtCore/QBuffer>
+#include <QtGui/QImage>
+#include <QtTest/QtTest>
+
+#include "liveviewtileencoder.h"
+
+using namespace sowatch;
+
+/** Builds a RGB16 test image; colors is the number of distinct colors
+ *  (0 for a smooth gradient, -1 for random noise). */
+static QImage makeImage(int width, int height, int colors)
+{
+	QImage image(width, height, QImage::Format_RGB16);
+	quint32 seed = 12345;
+
+	for (int y = 0; y < height; y++) {
+		quint16 *line = reinterpret_cast<quint16*>(image.scanLine(y));
+		for (int x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			if (colors > 0) {
+				// Spread the colors over the whole RGB16 range
+				line[x] = ((seed >> 16) % colors) * (0xFFFF / colors);
+			} else if (colors == 0) {
+				const int r = (x * 31) / qMax(width - 1, 1);
+				const int g = (y * 63) / qMax(height - 1, 1);
+				const int b = ((x + y) * 31) / qMax(width + height - 2, 1);
+				line[x] = (r << 11) | (g << 5) | b;
+			} else {
+				line[x] = seed >> 16;
+			}
+		}
+	}
+
+	return image;
+}
+
+static QByteArray qtPng(const QImage& image)
+{
+	QByteArray data;
+	QBuffer buffer(&data);
+	buffer.open(QIODevice::WriteOnly);
+	image.save(&buffer, "PNG");
+	return data;
+}
+
+class TestLiveViewTileEncoder : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void decodes_data();
+	void decodes();
+	void reusesEncoder();
+	void rejectsOtherFormats();
+
+	void size_data();
+	void size();
+
+	void benchmark_data();
+	void benchmark();
+};
+
+void TestLiveViewTileEncoder::decodes_data()
+{
+	QTest::addColumn<QImage>("image");
+
+	static const int sizes[][2] = {
+		{ 1, 1 }, { 3, 5 }, { 7, 13 }, { 17, 9 }, { 64, 64 }, { 128, 128 }
+	};
+	static const int colors[] = { 1, 2, 3, 4, 16, 17, 200, 256, 0, -1 };
+
+	for (uint s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (uint c = 0; c < sizeof(colors) / sizeof(colors[0]); c++) {
+			const int width = sizes[s][0], height = sizes[s][1];
+			QTest::newRow(qPrintable(QString("%1x%2, %3 colors").arg(width).arg(height).arg(colors[c])))
+			        << makeImage(width, height, colors[c]);
+		}
+	}
+}
+
+void TestLiveViewTileEncoder::decodes()
+{
+	QFETCH(QImage, image);
+
+	LiveViewTileEncoder encoder;
+	const QByteArray png = encoder.encode(image);
+	QVERIFY(!png.isEmpty());
+
+	QImage decoded;
+	QVERIFY(decoded.loadFromData(png, "PNG"));
+	QCOMPARE(decoded.size(), image.size());
+
+	const QImage expected = image.convertToFormat(QImage::Format_RGB32);
+	decoded = decoded.convertToFormat(QImage::Format_RGB32);
+	for (int y = 0; y < image.height(); y++) {
+		for (int x = 0; x < image.width(); x++) {
+			if (decoded.pixel(x, y) != expected.pixel(x, y)) {
+				QFAIL(qPrintable(QString("Pixel %1,%2 is %3 instead of %4")
+				                 .arg(x).arg(y)
+				                 .arg(decoded.pixel(x, y), 8, 16, QChar('0'))
+				                 .arg(expected.pixel(x, y), 8, 16, QChar('0'))));
+			}
+		}
+	}
+}
+
+void TestLiveViewTileEncoder::reusesEncoder()
+{
+	// The deflate state and palette tables are kept between tiles.
+	LiveViewTileEncoder encoder;
+	const QImage a = makeImage(64, 64, -1);
+	const QImage b = makeImage(33, 7, 3);
+
+	const QByteArray first = encoder.encode(a);
+	encoder.encode(b);
+	QCOMPARE(encoder.encode(a), first);
+
+	QImage decoded;
+	QVERIFY(decoded.loadFromData(encoder.encode(b), "PNG"));
+	QCOMPARE(decoded.convertToFormat(QImage::Format_RGB32),
+	         b.convertToFormat(QImage::Format_RGB32));
+}
+
+void TestLiveViewTileEncoder::rejectsOtherFormats()
+{
+	LiveViewTileEncoder encoder;
+	QImage image(16, 16, QImage::Format_RGB32);
+	image.fill(0);
+	QVERIFY(encoder.encode(image).isEmpty());
+	QVERIFY(encoder.encode(QImage()).isEmpty());
+}
+
+void TestLiveViewTileEncoder::size_data()
+{
+	QTest::addColumn<QImage>("image");
+
+	QTest::newRow("flat") << makeImage(64, 64, 1);
+	QTest::newRow("text") << makeImage(64, 64, 4);
+	QTest::newRow("icon") << makeImage(64, 64, 200);
+	QTest::newRow("gradient") << makeImage(64, 64, 0);
+	QTest::newRow("noise") << makeImage(64, 64, -1);
+}
+
+void TestLiveViewTileEncoder::size()
+{
+	QFETCH(QImage, image);
+
+	LiveViewTileEncoder encoder;
+	const int ours = encoder.encode(image).size();
+	const int qt = qtPng(image).size();
+
+	qDebug() << "encoded size" << ours << "bytes, QImage::save()" << qt << "bytes";
+	QVERIFY(ours > 0);
+	QVERIFY(qt > 0);
+}
+
+void TestLiveViewTileEncoder::benchmark_data()
+{
+	QTest::addColumn<bool>("qt");
+	QTest::addColumn<QImage>("image");
+
+	QTest::newRow("encoder, icon") << false << makeImage(64, 64, 200);
+	QTest::newRow("QImage::save, icon") << true << makeImage(64, 64, 200);
+	QTest::newRow("encoder, gradient") << false << makeImage(64, 64, 0);
+	QTest::newRow("QImage::save, gradient") << true << makeImage(64, 64, 0);
+	QTest::newRow("encoder, noise") << false << makeImage(64, 64, -1);
+	QTest::newRow("QImage::save, noise") << true << makeImage(64, 64, -1);
+}
+
+void TestLiveViewTileEncoder::benchmark()
+{
+	QFETCH(bool, qt);
+	QFETCH(QImage, image);
+
+	if (qt) {
+		QBENCHMARK {
+			qtPng(image);
+		}
+	} else {
+		LiveViewTileEncoder encoder;
+		QBENCHMARK {
+			encoder.encode(image);
+		}
+	}
+}
+
+QTEST_APPLESS_MAIN(TestLiveViewTileEncoder)
+
+#include "tst_liveviewtileencoder.moc"
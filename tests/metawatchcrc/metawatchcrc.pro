@@ -0,0 +1,10 @@
+TARGET = tst_metawatchcrc
+CONFIG += qtestlib testcase
+QT -= gui
+
+SOURCES += tst_metawatchcrc.cpp \
+    ../../metawatch/metawatchcrc.cpp
+
+HEADERS += ../../metawatch/metawatchcrc.h
+
+INCLUDEPATH += $$PWD/../../metawatch
@@ -0,0 +1,171 @@
+#include <QtCore/QByteArray>
+#include <QtTest/QtTest>
+
+#include "metawatchcrc.h"
+
+using namespace sowatch;
+
+/** The original implementation: CRC-CCITT, computed bit by bit,
+ *  over each byte with its bits reversed. */
+static quint16 referenceCrc(const char *data, int size)
+{
+	quint16 remainder = 0xFFFF;
+
+	for (int i = 0; i < size; i++) {
+		quint8 byte = data[i];
+		quint8 reversed = 0;
+		for (int bit = 0; bit < 8; bit++) {
+			if (byte & (1 << bit)) {
+				reversed |= 0x80 >> bit;
+			}
+		}
+		remainder ^= reversed << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			if (remainder & 0x8000) {
+				remainder = (remainder << 1) ^ 0x1021;
+			} else {
+				remainder = remainder << 1;
+			}
+		}
+	}
+
+	return remainder;
+}
+
+static QByteArray randomData(int size)
+{
+	QByteArray data(size, Qt::Uninitialized);
+	for (int i = 0; i < size; i++) {
+		data[i] = qrand() & 0xFF;
+	}
+	return data;
+}
+
+class TestMetaWatchCrc : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void empty();
+	void allSingleBytes();
+	void allBytePairs();
+	void edgeCases_data();
+	void edgeCases();
+	void randomBuffers();
+	void incremental();
+
+	void benchmark_data();
+	void benchmark();
+};
+
+void TestMetaWatchCrc::initTestCase()
+{
+	qsrand(0x5eed);
+}
+
+void TestMetaWatchCrc::empty()
+{
+	QCOMPARE(MetaWatchCrc::calculate(0, 0), quint16(0xFFFF));
+	QCOMPARE(MetaWatchCrc().value(), referenceCrc(0, 0));
+}
+
+void TestMetaWatchCrc::allSingleBytes()
+{
+	for (int i = 0; i < 256; i++) {
+		const char byte = i;
+		QCOMPARE(MetaWatchCrc::calculate(&byte, 1), referenceCrc(&byte, 1));
+	}
+}
+
+void TestMetaWatchCrc::allBytePairs()
+{
+	for (int i = 0; i < 65536; i++) {
+		const char bytes[2] = { char(i & 0xFF), char(i >> 8) };
+		if (MetaWatchCrc::calculate(bytes, 2) != referenceCrc(bytes, 2)) {
+			QFAIL(qPrintable(QString("Mismatch for bytes %1").arg(i, 4, 16, QChar('0'))));
+		}
+	}
+}
+
+void TestMetaWatchCrc::edgeCases_data()
+{
+	QTest::addColumn<QByteArray>("data");
+
+	QTest::newRow("zeros") << QByteArray(300, '\0');
+	QTest::newRow("ones") << QByteArray(300, '\xFF');
+	QTest::newRow("alternating") << QByteArray(300, '\x55');
+	QTest::newRow("header") << QByteArray("\x01\x06\x23\x00", 4);
+	// A full WriteLcdBuffer frame without its CRC
+	QTest::newRow("lcd buffer") << QByteArray("\x01\x20\x40\x10", 4) + QByteArray(28, '\xAA');
+}
+
+void TestMetaWatchCrc::edgeCases()
+{
+	QFETCH(QByteArray, data);
+	QCOMPARE(MetaWatchCrc::calculate(data.constData(), data.size()),
+	         referenceCrc(data.constData(), data.size()));
+}
+
+void TestMetaWatchCrc::randomBuffers()
+{
+	for (int size = 0; size < 300; size++) {
+		for (int round = 0; round < 8; round++) {
+			const QByteArray data = randomData(size);
+			QCOMPARE(MetaWatchCrc::calculate(data.constData(), data.size()),
+			         referenceCrc(data.constData(), data.size()));
+		}
+	}
+}
+
+void TestMetaWatchCrc::incremental()
+{
+	const QByteArray data = randomData(64);
+	const quint16 expected = referenceCrc(data.constData(), data.size());
+
+	for (int split = 0; split <= data.size(); split++) {
+		MetaWatchCrc crc;
+		for (int i = 0; i < split; i++) {
+			crc.update(quint8(data[i]));
+		}
+		crc.update(data.constData() + split, data.size() - split);
+		QCOMPARE(crc.value(), expected);
+	}
+}
+
+void TestMetaWatchCrc::benchmark_data()
+{
+	QTest::addColumn<bool>("reference");
+	QTest::addColumn<int>("size");
+
+	QTest::newRow("table, frame") << false << 32;
+	QTest::newRow("reference, frame") << true << 32;
+	QTest::newRow("table, 4 KiB") << false << 4096;
+	QTest::newRow("reference, 4 KiB") << true << 4096;
+}
+
+void TestMetaWatchCrc::benchmark()
+{
+	QFETCH(bool, reference);
+	QFETCH(int, size);
+
+	const QByteArray data = randomData(size);
+	volatile quint16 result = 0;
+
+	if (reference) {
+		QBENCHMARK {
+			result = referenceCrc(data.constData(), data.size());
+		}
+	} else {
+		QBENCHMARK {
+			result = MetaWatchCrc::calculate(data.constData(), data.size());
+		}
+	}
+
+	Q_UNUSED(result);
+}
+
+QTEST_APPLESS_MAIN(TestMetaWatchCrc)
+
+#include "tst_metawatchcrc.moc"
@@ -0,0 +1,12 @@
+TARGET = tst_metawatchframeparser
+CONFIG += qtestlib testcase
+QT -= gui
+
+SOURCES += tst_metawatchframeparser.cpp \
+    ../../metawatch/metawatchcrc.cpp \
+    ../../metawatch/metawatchframeparser.cpp
+
+HEADERS += ../../metawatch/metawatchcrc.h \
+    ../../metawatch/metawatchframeparser.h
+
+INCLUDEPATH += $$PWD/../../metawatch
@@ -0,0 +1,295 @@
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtTest/QtTest>
+
+#include "metawatchcrc.h"
+#include "metawatchframeparser.h"
+
+using namespace sowatch;
+
+/** Small deterministic generator, so that the fuzzed streams are the same
+ *  on every platform and never contain accidental CRC collisions. */
+class Random
+{
+public:
+	explicit Random(quint32 seed) : _state(seed) { }
+
+	quint32 next()
+	{
+		_state ^= _state << 13;
+		_state ^= _state >> 17;
+		_state ^= _state << 5;
+		return _state;
+	}
+
+	int bounded(int min, int max)
+	{
+		return min + next() % (max - min + 1);
+	}
+
+	/** A byte that is never a frame start byte. */
+	char byte()
+	{
+		char c;
+		do {
+			c = next() & 0xFF;
+		} while (c == 0x01);
+		return c;
+	}
+
+	QByteArray bytes(int size)
+	{
+		QByteArray data;
+		for (int i = 0; i < size; i++) {
+			data.append(byte());
+		}
+		return data;
+	}
+
+private:
+	quint32 _state;
+};
+
+static QByteArray makeFrame(quint8 type, quint8 options, const QByteArray& payload)
+{
+	QByteArray frame;
+	frame.append(char(0x01));
+	frame.append(char(payload.size() + MetaWatchFrameParser::MinFrameSize));
+	frame.append(char(type));
+	frame.append(char(options));
+	frame.append(payload);
+	const quint16 crc = MetaWatchCrc::calculate(frame.constData(), frame.size());
+	frame.append(char(crc & 0xFF));
+	frame.append(char(crc >> 8));
+	return frame;
+}
+
+static QByteArray randomFrame(Random *random)
+{
+	const int size = random->bounded(0, 255 - MetaWatchFrameParser::MinFrameSize);
+	return makeFrame(random->byte(), random->byte(), random->bytes(size));
+}
+
+/** The frame in the same format as makeFrame(), to compare them. */
+static QByteArray frameBytes(const MetaWatchFrameParser::Frame& frame)
+{
+	return makeFrame(frame.type, frame.options, QByteArray(frame.data, frame.size));
+}
+
+class TestMetaWatchFrameParser : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void singleFrame();
+	void splitAtEveryOffset();
+	void byteByByte();
+	void garbagePrefix();
+	void falseStartPrefix();
+	void truncatedFrame();
+	void badCrc();
+	void backToBack();
+	void fuzz();
+
+private:
+	/** Feeds the stream in chunks of the given size and returns all the frames,
+	 *  checking that the parser never keeps more than a frame's worth of bytes. */
+	QList<QByteArray> parse(MetaWatchFrameParser *parser, const QByteArray& stream, int chunk);
+	QList<QByteArray> parse(const QByteArray& stream, int chunk = 4096);
+	QList<QByteArray> drain(MetaWatchFrameParser *parser);
+};
+
+QList<QByteArray> TestMetaWatchFrameParser::drain(MetaWatchFrameParser *parser)
+{
+	QList<QByteArray> frames;
+	MetaWatchFrameParser::Frame frame;
+	while (parser->next(&frame)) {
+		frames.append(frameBytes(frame));
+	}
+	return frames;
+}
+
+QList<QByteArray> TestMetaWatchFrameParser::parse(MetaWatchFrameParser *parser, const QByteArray& stream, int chunk)
+{
+	QList<QByteArray> frames;
+	for (int pos = 0; pos < stream.size(); pos += chunk) {
+		const int size = qMin(chunk, stream.size() - pos);
+		parser->append(stream.constData() + pos, size);
+		frames += drain(parser);
+		if (parser->pendingBytes() >= 255) {
+			QTest::qFail("Parser keeps too many bytes", __FILE__, __LINE__);
+			return frames;
+		}
+	}
+	return frames;
+}
+
+QList<QByteArray> TestMetaWatchFrameParser::parse(const QByteArray& stream, int chunk)
+{
+	MetaWatchFrameParser parser;
+	return parse(&parser, stream, chunk);
+}
+
+void TestMetaWatchFrameParser::singleFrame()
+{
+	const QByteArray frame = makeFrame(0x33, 0x02, QByteArray("\x10\x20\x30", 3));
+	MetaWatchFrameParser parser;
+	const QList<QByteArray> frames = parse(&parser, frame, frame.size());
+
+	QCOMPARE(frames.size(), 1);
+	QCOMPARE(frames.first(), frame);
+	QCOMPARE(parser.pendingBytes(), 0);
+	QCOMPARE(parser.droppedBytes(), 0u);
+	QCOMPARE(parser.crcErrors(), 0u);
+}
+
+void TestMetaWatchFrameParser::splitAtEveryOffset()
+{
+	const QByteArray a = makeFrame(0x02, 0x00, QByteArray());
+	const QByteArray b = makeFrame(0x34, 0x01, QByteArray(20, '\x55'));
+	const QByteArray stream = a + b;
+
+	for (int split = 0; split <= stream.size(); split++) {
+		MetaWatchFrameParser parser;
+		QList<QByteArray> frames;
+		parser.append(stream.constData(), split);
+		frames += drain(&parser);
+		parser.append(stream.constData() + split, stream.size() - split);
+		frames += drain(&parser);
+
+		QCOMPARE(frames.size(), 2);
+		QCOMPARE(frames.at(0), a);
+		QCOMPARE(frames.at(1), b);
+		QCOMPARE(parser.pendingBytes(), 0);
+	}
+}
+
+void TestMetaWatchFrameParser::byteByByte()
+{
+	Random random(1);
+	QByteArray stream;
+	QList<QByteArray> expected;
+	for (int i = 0; i < 10; i++) {
+		expected.append(randomFrame(&random));
+		stream += expected.last();
+	}
+
+	QCOMPARE(parse(stream, 1), expected);
+}
+
+void TestMetaWatchFrameParser::garbagePrefix()
+{
+	Random random(2);
+	const QByteArray garbage = random.bytes(100);
+	const QByteArray frame = makeFrame(0x02, 0x00, QByteArray("abc"));
+
+	MetaWatchFrameParser parser;
+	const QList<QByteArray> frames = parse(&parser, garbage + frame, 7);
+
+	QCOMPARE(frames.size(), 1);
+	QCOMPARE(frames.first(), frame);
+	QCOMPARE(parser.droppedBytes(), uint(garbage.size()));
+}
+
+void TestMetaWatchFrameParser::falseStartPrefix()
+{
+	// A start byte with a length longer than the rest of the stream
+	// must not hold back the complete frame that follows it.
+	const QByteArray frame = makeFrame(0x02, 0x00, QByteArray("abc"));
+	const QList<QByteArray> frames = parse(QByteArray("\x01\xFF\x00", 3) + frame);
+
+	QCOMPARE(frames.size(), 1);
+	QCOMPARE(frames.first(), frame);
+}
+
+void TestMetaWatchFrameParser::truncatedFrame()
+{
+	const QByteArray lost = makeFrame(0x40, 0x00, QByteArray(30, '\x22'));
+	const QByteArray frame = makeFrame(0x02, 0x00, QByteArray("abc"));
+
+	for (int cut = 1; cut < lost.size() - 2; cut++) {
+		const QList<QByteArray> frames = parse(lost.left(cut) + frame, 5);
+		QCOMPARE(frames.size(), 1);
+		QCOMPARE(frames.first(), frame);
+	}
+}
+
+void TestMetaWatchFrameParser::badCrc()
+{
+	QByteArray bad = makeFrame(0x33, 0x00, QByteArray(12, '\x42'));
+	bad[bad.size() - 1] = bad[bad.size() - 1] ^ 0x80;
+	const QByteArray frame = makeFrame(0x02, 0x00, QByteArray("abc"));
+
+	MetaWatchFrameParser parser;
+	const QList<QByteArray> frames = parse(&parser, bad + frame + bad, 4096);
+
+	QCOMPARE(frames.size(), 1);
+	QCOMPARE(frames.first(), frame);
+	QVERIFY(parser.crcErrors() >= 2);
+}
+
+void TestMetaWatchFrameParser::backToBack()
+{
+	Random random(3);
+	QByteArray stream;
+	QList<QByteArray> expected;
+	for (int i = 0; i < 100; i++) {
+		expected.append(randomFrame(&random));
+		stream += expected.last();
+	}
+
+	MetaWatchFrameParser parser;
+	QCOMPARE(parse(&parser, stream, stream.size()), expected);
+	QCOMPARE(parser.droppedBytes(), 0u);
+	QCOMPARE(parser.pendingBytes(), 0);
+}
+
+void TestMetaWatchFrameParser::fuzz()
+{
+	Random random(0x5eed);
+
+	for (int round = 0; round < 500; round++) {
+		QByteArray stream;
+		QList<QByteArray> expected;
+
+		const int parts = random.bounded(1, 20);
+		for (int i = 0; i < parts; i++) {
+			const QByteArray frame = randomFrame(&random);
+			switch (random.bounded(0, 3)) {
+			case 0: // Valid frame
+				expected.append(frame);
+				stream += frame;
+				break;
+			case 1: // Garbage
+				stream += random.bytes(random.bounded(1, 40));
+				break;
+			case 2: // Truncated frame, cut before its CRC
+				stream += frame.left(random.bounded(1, frame.size() - 3));
+				break;
+			case 3: { // Bad CRC
+				QByteArray bad = frame;
+				char c;
+				do {
+					c = bad[bad.size() - 2] ^ random.bounded(1, 255);
+				} while (c == 0x01);
+				bad[bad.size() - 2] = c;
+				stream += bad;
+				break;
+			}
+			}
+		}
+
+		// A valid frame at the end flushes any truncated frame before it.
+		expected.append(randomFrame(&random));
+		stream += expected.last();
+
+		const QList<QByteArray> frames = parse(stream, random.bounded(1, 64));
+		if (frames != expected) {
+			QFAIL(qPrintable(QString("Wrong frames in round %1").arg(round)));
+		}
+	}
+}
+
+QTEST_APPLESS_MAIN(TestMetaWatchFrameParser)
+
+#include "tst_metawatchframeparser.moc"
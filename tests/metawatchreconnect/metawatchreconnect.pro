@@ -0,0 +1,36 @@
+TARGET = tst_metawatchreconnect
+CONFIG += qtestlib testcase
+QT += gui
+
+# Qt Mobility 1.2
+maemo5 {
+	CONFIG += mobility12
+} else {
+	CONFIG += mobility
+}
+MOBILITY += connectivity systeminfo
+
+SOURCES += tst_metawatchreconnect.cpp \
+    ../../metawatch/metawatch.cpp \
+    ../../metawatch/metawatchdigital.cpp \
+    ../../metawatch/metawatchpaintengine.cpp \
+    ../../metawatch/metawatchcrc.cpp \
+    ../../metawatch/metawatchframeparser.cpp
+
+HEADERS += ../../metawatch/metawatch.h \
+    ../../metawatch/metawatchdigital.h \
+    ../../metawatch/metawatchpaintengine.h \
+    ../../metawatch/metawatchcrc.h \
+    ../../metawatch/metawatchframeparser.h
+
+INCLUDEPATH += $$PWD/../../metawatch
+
+LIBS += -L$$OUT_PWD/../../libsowatch/ -lsowatch
+INCLUDEPATH += $$PWD/../../libsowatch
+DEPENDPATH += $$PWD/../../libsowatch
+QMAKE_RPATHDIR += $$OUT_PWD/../../libsowatch
+
+LIBS += -L$$OUT_PWD/../../libsowatchbt/ -lsowatchbt
+INCLUDEPATH += $$PWD/../../libsowatchbt
+DEPENDPATH += $$PWD/../../libsowatchbt
+QMAKE_RPATHDIR += $$OUT_PWD/../../libsowatchbt
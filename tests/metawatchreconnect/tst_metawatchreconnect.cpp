@@ -0,0 +1,159 @@
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+#include <QtTest/QtTest>
+
+#include "metawatchdigital.h"
+
+using namespace sowatch;
+
+/** A settings tree without any value set. */
+class TestConfigKey : public ConfigKey
+{
+public:
+	explicit TestConfigKey(QObject *parent = 0) : ConfigKey(parent) { }
+
+	QString key() const { return QString(); }
+	void setKey(const QString& key) { Q_UNUSED(key); }
+
+	QVariant value() const { return QVariant(); }
+	void set(const QVariant& value) { Q_UNUSED(value); }
+	void unset() { }
+	bool isSet() const { return false; }
+	bool isDir() const { return false; }
+
+	QVariant value(const QString& subkey) const { Q_UNUSED(subkey); return QVariant(); }
+	QVariant value(const QString& subkey, const QVariant& def) const { Q_UNUSED(subkey); return def; }
+	void set(const QString& subkey, const QVariant& value) { Q_UNUSED(subkey); Q_UNUSED(value); }
+	void unset(const QString& subkey) { Q_UNUSED(subkey); }
+	bool isSet(const QString& subkey) const { Q_UNUSED(subkey); return false; }
+	bool isDir(const QString& subkey) const { Q_UNUSED(subkey); return false; }
+
+	QStringList dirs() const { return QStringList(); }
+	QStringList keys() const { return QStringList(); }
+
+	void recursiveUnset() { }
+
+	ConfigKey* getSubkey(const QString& subkey, QObject *parent = 0) const
+	{
+		Q_UNUSED(subkey);
+		return new TestConfigKey(parent);
+	}
+};
+
+/** A MetaWatch Digital without Bluetooth, which applies the messages
+ *  it sends to a simulated copy of the watch mode buffers. */
+class TestMetaWatch : public MetaWatchDigital
+{
+public:
+	explicit TestMetaWatch(ConfigKey *settings) : MetaWatchDigital(settings)
+	{
+		for (int i = 0; i < 3; i++) {
+			_image[i].fill(0);
+			_screen[i] = _image[i].copy();
+		}
+	}
+
+	void connectToWatch()
+	{
+		if (_connected) return;
+		// The watch buffers may contain anything after a connection.
+		for (int i = 0; i < 3; i++) {
+			_screen[i].fill(1);
+		}
+		_connected = true;
+		setupBluetoothWatch();
+	}
+
+	void disconnectFromWatch()
+	{
+		if (!_connected) return;
+		_connected = false;
+		desetupBluetoothWatch();
+	}
+
+	const QImage& screen(Mode mode) const
+	{
+		return _screen[mode];
+	}
+
+protected:
+	void send(const Message& msg)
+	{
+		const Mode mode = static_cast<Mode>(msg.options & 0x3);
+		switch (msg.type) {
+		case LoadLcdTemplate:
+			_screen[mode].fill(msg.data[0] ? 1 : 0);
+			break;
+		case WriteLcdBuffer:
+			QVERIFY(msg.lineA >= 0);
+			copyLine(mode, msg.lineA);
+			if (msg.lineB >= 0) {
+				copyLine(mode, msg.lineB);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+private:
+	void copyLine(Mode mode, int line)
+	{
+		memcpy(_screen[mode].scanLine(line), _image[mode].constScanLine(line),
+		       _image[mode].width() / 8);
+	}
+
+	QImage _screen[3];
+};
+
+class TestMetaWatchReconnect : public QObject
+{
+	Q_OBJECT
+
+private:
+	static void paintFrame(TestMetaWatch *watch)
+	{
+		QPainter p(watch);
+		p.fillRect(10, 20, 30, 15, Qt::black);
+		p.setPen(Qt::black);
+		p.drawLine(0, 60, 95, 70);
+	}
+
+	static bool screenMatches(TestMetaWatch *watch, MetaWatch::Mode mode)
+	{
+		const QImage& screen = watch->screen(mode);
+		const QImage& image = *watch->imageFor(mode);
+		for (int line = 0; line < image.height(); line++) {
+			if (memcmp(screen.constScanLine(line), image.constScanLine(line),
+			           image.width() / 8) != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private slots:
+	void reconnect()
+	{
+		TestConfigKey settings;
+		TestMetaWatch watch(&settings);
+
+		watch.connectToWatch();
+		watch.displayApplication();
+		paintFrame(&watch);
+		QVERIFY(screenMatches(&watch, MetaWatch::ApplicationMode));
+
+		// Repainting the same frame after a reconnect produces no damage,
+		// but the watch lost what it had.
+		watch.disconnectFromWatch();
+		watch.connectToWatch();
+		QVERIFY(!screenMatches(&watch, MetaWatch::ApplicationMode));
+		watch.displayApplication();
+		paintFrame(&watch);
+		QVERIFY(screenMatches(&watch, MetaWatch::ApplicationMode));
+	}
+};
+
+QTEST_MAIN(TestMetaWatchReconnect)
+
+#include "tst_metawatchreconnect.moc"
@@ -0,0 +1,10 @@
+TARGET = tst_monoconverter
+CONFIG += qtestlib testcase
+QT += gui
+
+SOURCES += tst_monoconverter.cpp \
+    ../../libsowatch/monoconverter.cpp
+
+HEADERS += ../../libsowatch/monoconverter.h
+
+INCLUDEPATH += $$PWD/../../libsowatch
@@ -0,0 +1,254 @@
+#include <QtGui/QImage>
+#include <QtTest/QtTest>
+
+#include "monoconverter.h"
+
+using namespace sowatch;
+
+Q_DECLARE_METATYPE(MonoConverter::Method)
+
+/** Same matrix as the one used by MonoConverter. */
+static const uchar bayerThresholds[8][8] = {
+	{   2, 130,  34, 162,  10, 138,  42, 170 },
+	{ 194,  66, 226,  98, 202,  74, 234, 106 },
+	{  50, 178,  18, 146,  58, 186,  26, 154 },
+	{ 242, 114, 210,  82, 250, 122, 218,  90 },
+	{  14, 142,  46, 174,   6, 134,  38, 166 },
+	{ 206,  78, 238, 110, 198,  70, 230, 102 },
+	{  62, 190,  30, 158,  54, 182,  22, 150 },
+	{ 254, 126, 222,  94, 246, 118, 214,  86 }
+};
+
+/** Fills an RGB32 image with noise, and every fourth row with a ramp
+ *  of grays that crosses every threshold. */
+static void fillImage(QImage *image, quint32 seed)
+{
+	for (int y = 0; y < image->height(); y++) {
+		QRgb *line = reinterpret_cast<QRgb*>(image->scanLine(y));
+		for (int x = 0; x < image->width(); x++) {
+			seed = seed * 1103515245 + 12345;
+			if (y % 4 == 3) {
+				line[x] = qRgb(x & 0xFF, x & 0xFF, x & 0xFF);
+			} else {
+				line[x] = seed ^ (seed >> 16);
+			}
+		}
+	}
+}
+
+/** The plain per pixel conversion, which both the vectorized and the
+ *  SOWATCH_NO_SIMD builds of MonoConverter must match. */
+static QImage referenceConvert(const QImage& src, MonoConverter::Method method, int threshold)
+{
+	QImage dst = MonoConverter::createMonoImage(src.size());
+
+	if (method == MonoConverter::AdaptiveThreshold) {
+		uint histogram[256];
+		memset(histogram, 0, sizeof(histogram));
+		for (int y = 0; y < src.height(); y++) {
+			for (int x = 0; x < src.width(); x++) {
+				histogram[MonoConverter::luma(src.pixel(x, y))]++;
+			}
+		}
+		threshold = MonoConverter::histogramThreshold(histogram);
+	}
+
+	for (int y = 0; y < src.height(); y++) {
+		for (int x = 0; x < src.width(); x++) {
+			const int t = method == MonoConverter::OrderedDither ?
+			            bayerThresholds[y % 8][x % 8] : threshold;
+			dst.setPixel(x, y, MonoConverter::luma(src.pixel(x, y)) < t ? 1 : 0);
+		}
+	}
+
+	return dst;
+}
+
+class TestMonoConverter : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void luma();
+
+	void matchesReference_data();
+	void matchesReference();
+	void partialRows_data();
+	void partialRows();
+
+	void benchmark_data();
+	void benchmark();
+
+private:
+	/** Fails unless both mono images have the same pixels in the given rows. */
+	bool compareRows(const QImage& actual, const QImage& expected, int top, int rows);
+};
+
+bool TestMonoConverter::compareRows(const QImage& actual, const QImage& expected, int top, int rows)
+{
+	for (int y = top; y < top + rows; y++) {
+		for (int x = 0; x < actual.width(); x++) {
+			if (actual.pixelIndex(x, y) != expected.pixelIndex(x, y)) {
+				QTest::qFail(qPrintable(QString("Pixel %1,%2 is %3 instead of %4")
+				                        .arg(x).arg(y)
+				                        .arg(actual.pixelIndex(x, y))
+				                        .arg(expected.pixelIndex(x, y))),
+				             __FILE__, __LINE__);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void TestMonoConverter::luma()
+{
+	// Every level of every channel on its own, through the vectorized
+	// path (full rows of 16 pixels) and the scalar tail (the last one).
+	for (int c = 0; c < 3; c++) {
+		QImage src(257, 1, QImage::Format_RGB32);
+		QRgb *line = reinterpret_cast<QRgb*>(src.scanLine(0));
+		for (int v = 0; v < 256; v++) {
+			line[v] = qRgb(c == 0 ? v : 0, c == 1 ? v : 0, c == 2 ? v : 0);
+		}
+		line[256] = qRgb(255, 255, 255);
+
+		for (int t = 0; t <= 255; t += 15) {
+			const MonoConverter converter(MonoConverter::Threshold, t);
+			if (!compareRows(converter.convert(src),
+			                 referenceConvert(src, MonoConverter::Threshold, t), 0, 1)) {
+				return;
+			}
+		}
+	}
+}
+
+void TestMonoConverter::matchesReference_data()
+{
+	QTest::addColumn<MonoConverter::Method>("method");
+	QTest::addColumn<int>("threshold");
+	QTest::addColumn<int>("width");
+	QTest::addColumn<int>("offset");
+
+	static const int widths[] = { 1, 7, 8, 9, 15, 16, 17, 23, 31, 32, 33, 63, 96, 127, 129 };
+	static const struct {
+		MonoConverter::Method method;
+		int threshold;
+		const char *name;
+	} methods[] = {
+		{ MonoConverter::Threshold, 128, "threshold 128" },
+		{ MonoConverter::Threshold, 0, "threshold 0" },
+		{ MonoConverter::Threshold, 1, "threshold 1" },
+		{ MonoConverter::Threshold, 255, "threshold 255" },
+		{ MonoConverter::OrderedDither, 128, "ordered" },
+		{ MonoConverter::AdaptiveThreshold, 128, "adaptive" }
+	};
+
+	for (uint m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+		for (uint w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+			// Rows starting at every alignment within a SSE2 register.
+			for (int offset = 0; offset < 4; offset++) {
+				QTest::newRow(qPrintable(QString("%1, width %2, offset %3")
+				                         .arg(methods[m].name).arg(widths[w]).arg(offset)))
+				        << methods[m].method << methods[m].threshold << widths[w] << offset;
+			}
+		}
+	}
+}
+
+void TestMonoConverter::matchesReference()
+{
+	QFETCH(MonoConverter::Method, method);
+	QFETCH(int, threshold);
+	QFETCH(int, width);
+	QFETCH(int, offset);
+
+	const int height = 19;
+	// View into a wider image, so that no row starts on an aligned address
+	// unless offset is 0, and rows are not a multiple of 16 bytes apart.
+	QImage storage(width + 5, height, QImage::Format_RGB32);
+	fillImage(&storage, width * 4 + offset);
+	const QImage src(storage.constBits() + offset * sizeof(QRgb), width, height,
+	                 storage.bytesPerLine(), QImage::Format_RGB32);
+
+	const MonoConverter converter(method, threshold);
+	const QImage dst = converter.convert(src);
+	QCOMPARE(dst.size(), src.size());
+	compareRows(dst, referenceConvert(src, method, threshold), 0, height);
+}
+
+void TestMonoConverter::partialRows_data()
+{
+	QTest::addColumn<MonoConverter::Method>("method");
+	QTest::addColumn<int>("top");
+	QTest::addColumn<int>("rows");
+
+	QTest::newRow("threshold, first row") << MonoConverter::Threshold << 0 << 1;
+	QTest::newRow("threshold, middle rows") << MonoConverter::Threshold << 5 << 7;
+	QTest::newRow("threshold, past the end") << MonoConverter::Threshold << 20 << 10;
+	QTest::newRow("ordered, first row") << MonoConverter::OrderedDither << 0 << 1;
+	QTest::newRow("ordered, middle rows") << MonoConverter::OrderedDither << 5 << 7;
+	QTest::newRow("ordered, past the end") << MonoConverter::OrderedDither << 20 << 10;
+}
+
+void TestMonoConverter::partialRows()
+{
+	QFETCH(MonoConverter::Method, method);
+	QFETCH(int, top);
+	QFETCH(int, rows);
+
+	QImage src(61, 24, QImage::Format_RGB32);
+	fillImage(&src, 42);
+
+	const MonoConverter converter(method);
+	const QImage expected = referenceConvert(src, method, converter.threshold());
+	QImage dst = MonoConverter::createMonoImage(src.size());
+	converter.convert(src, &dst, top, rows);
+
+	rows = qMin(rows, src.height() - top);
+	const QImage blank = MonoConverter::createMonoImage(src.size());
+	if (!compareRows(dst, blank, 0, top)) return;
+	if (!compareRows(dst, expected, top, rows)) return;
+	compareRows(dst, blank, top + rows, src.height() - top - rows);
+}
+
+void TestMonoConverter::benchmark_data()
+{
+	QTest::addColumn<MonoConverter::Method>("method");
+	QTest::addColumn<bool>("reference");
+
+	QTest::newRow("threshold") << MonoConverter::Threshold << false;
+	QTest::newRow("threshold, reference") << MonoConverter::Threshold << true;
+	QTest::newRow("ordered") << MonoConverter::OrderedDither << false;
+	QTest::newRow("ordered, reference") << MonoConverter::OrderedDither << true;
+	QTest::newRow("adaptive") << MonoConverter::AdaptiveThreshold << false;
+	QTest::newRow("adaptive, reference") << MonoConverter::AdaptiveThreshold << true;
+	QTest::newRow("floyd-steinberg") << MonoConverter::FloydSteinbergDither << false;
+}
+
+void TestMonoConverter::benchmark()
+{
+	QFETCH(MonoConverter::Method, method);
+	QFETCH(bool, reference);
+
+	// The size of the MetaWatch screen
+	QImage src(96, 96, QImage::Format_RGB32);
+	fillImage(&src, 1);
+
+	const MonoConverter converter(method);
+	QImage dst = MonoConverter::createMonoImage(src.size());
+
+	if (reference) {
+		QBENCHMARK {
+			dst = referenceConvert(src, method, converter.threshold());
+		}
+	} else {
+		QBENCHMARK {
+			converter.convert(src, &dst, 0, src.height());
+		}
+	}
+}
+
+QTEST_APPLESS_MAIN(TestMonoConverter)
+
+#include "tst_monoconverter.moc"
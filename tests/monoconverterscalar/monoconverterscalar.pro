@@ -0,0 +1,14 @@
+# The same tests and benchmarks as in monoconverter,
+# against the portable code instead of the SSE2/NEON one.
+TARGET = tst_monoconverterscalar
+CONFIG += qtestlib testcase
+QT += gui
+
+DEFINES += SOWATCH_NO_SIMD
+
+SOURCES += ../monoconverter/tst_monoconverter.cpp \
+    ../../libsowatch/monoconverter.cpp
+
+HEADERS += ../../libsowatch/monoconverter.h
+
+INCLUDEPATH += $$PWD/../../libsowatch
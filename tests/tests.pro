@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+
+# Unit tests and benchmarks for the performance sensitive parts.
+# Enable them with "qmake CONFIG+=tests" and run them with "make check".
+SUBDIRS += metawatchcrc metawatchframeparser liveviewtileencoder watchpaintengine monoconverter monoconverterscalar \
+    metawatchreconnect watchpaintenginescalar
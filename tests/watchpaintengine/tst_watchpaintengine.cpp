@@ -0,0 +1,417 @@
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+#include <QtTest/QtTest>
+#include <math.h>
+
+#include "watchpaintengine.h"
+
+using namespace sowatch;
+
+Q_DECLARE_METATYPE(QImage::Format)
+Q_DECLARE_METATYPE(WatchPaintEngine::DamageMode)
+
+/** Small deterministic generator, so that the shapes are the same everywhere. */
+class Random
+{
+public:
+	explicit Random(quint32 seed) : _state(seed) { }
+
+	quint32 next()
+	{
+		_state ^= _state << 13;
+		_state ^= _state >> 17;
+		_state ^= _state << 5;
+		return _state;
+	}
+
+	int bounded(int min, int max)
+	{
+		return min + next() % (max - min + 1);
+	}
+
+	qreal real(qreal min, qreal max)
+	{
+		return min + (max - min) * (next() % 65536) / 65535.0;
+	}
+
+private:
+	quint32 _state;
+};
+
+/** Paints through a WatchPaintEngine into an image, like the watches do. */
+class TestPaintEngine : public WatchPaintEngine
+{
+public:
+	explicit TestPaintEngine(QImage *image) : _image(image) { }
+
+	bool begin(QPaintDevice *pdev)
+	{
+		Q_UNUSED(pdev);
+		return WatchPaintEngine::begin(_image);
+	}
+
+private:
+	QImage *_image;
+};
+
+class ImageDevice : public QPaintDevice
+{
+public:
+	ImageDevice(QImage::Format format, int accumulator, WatchPaintEngine::DamageMode mode)
+		: image(96, 96, format), _engine(new TestPaintEngine(&image))
+	{
+		if (image.depth() == 1) {
+			image.setColor(0, QColor(Qt::white).rgb());
+			image.setColor(1, QColor(Qt::black).rgb());
+		}
+		switch (accumulator) {
+		case 1:
+			_engine->setDamageAccumulator(new RowDamage(false));
+			break;
+		case 2:
+			_engine->setDamageAccumulator(new RowDamage(true));
+			break;
+		}
+		_engine->setDamageMode(mode);
+	}
+
+	~ImageDevice()
+	{
+		delete _engine;
+	}
+
+	QPaintEngine* paintEngine() const
+	{
+		return _engine;
+	}
+
+	QRegion damagedRegion() const
+	{
+		return _engine->damagedRegion();
+	}
+
+	/** Fills the image with noise, so that any painting changes pixels. */
+	void fillNoise(Random *random)
+	{
+		for (int y = 0; y < image.height(); y++) {
+			uchar *line = image.scanLine(y);
+			if (image.depth() == 32) {
+				for (int x = 0; x < image.width(); x++) {
+					reinterpret_cast<quint32*>(line)[x] = 0xFF000000U | random->next();
+				}
+			} else {
+				for (int i = 0; i < image.bytesPerLine(); i++) {
+					line[i] = random->next() & 0xFF;
+				}
+			}
+		}
+	}
+
+	QImage image;
+
+protected:
+	int metric(PaintDeviceMetric metric) const
+	{
+		switch (metric) {
+		case PdmWidth:
+			return image.width();
+		case PdmHeight:
+			return image.height();
+		case PdmWidthMM:
+			return image.widthMM();
+		case PdmHeightMM:
+			return image.heightMM();
+		case PdmNumColors:
+			return image.depth() == 1 ? 2 : 0xFFFFFF;
+		case PdmDepth:
+			return image.depth();
+		case PdmDpiX:
+		case PdmPhysicalDpiX:
+			return image.logicalDpiX();
+		case PdmDpiY:
+		case PdmPhysicalDpiY:
+			return image.logicalDpiY();
+		}
+
+		return -1;
+	}
+
+private:
+	TestPaintEngine *_engine;
+};
+
+enum Shape {
+	FilledRect,
+	RectOutline,
+	RotatedRect,
+	ConcavePolygon,
+	OddEvenStar,
+	Ellipse,
+	ThickLine,
+	CosmeticLines,
+	CurvedPath,
+	Polyline,
+	Points,
+	ClippedFill,
+	ShapeCount
+};
+
+static const char * const shapeNames[ShapeCount] = {
+	"filled rect", "rect outline", "rotated rect", "concave polygon",
+	"odd-even star", "ellipse", "thick line", "cosmetic lines",
+	"curved path", "polyline", "points", "clipped fill"
+};
+
+/** Paints a shape; each frame moves it, and parts of it go off the device. */
+static void paintShape(QPainter *p, int shape, int frame)
+{
+	const qreal d = frame * 23.25 - 10.0;
+	const QPen thick(QBrush(Qt::black), 3.5, Qt::SolidLine, Qt::SquareCap, Qt::MiterJoin);
+
+	switch (shape) {
+	case FilledRect:
+		p->fillRect(QRectF(d + 0.3, d * 0.5 + 10.6, 30.4, 17.7), Qt::black);
+		break;
+	case RectOutline:
+		p->setPen(thick);
+		p->setBrush(Qt::NoBrush);
+		p->drawRect(QRectF(d, 20.5, 40.25, 25.5));
+		break;
+	case RotatedRect:
+		p->translate(48.0, 48.0);
+		p->rotate(17.0 + frame * 31.0);
+		p->setPen(Qt::NoPen);
+		p->setBrush(Qt::black);
+		p->drawRect(QRectF(-20.0 + d * 0.5, -12.5, 45.0, 25.0));
+		break;
+	case ConcavePolygon: {
+		const QPointF arrow[] = {
+			QPointF(d + 5.5, 40.2), QPointF(d + 40.0, 10.0), QPointF(d + 30.3, 35.0),
+			QPointF(d + 70.0, 38.9), QPointF(d + 30.7, 45.0), QPointF(d + 40.0, 80.1)
+		};
+		p->setPen(Qt::NoPen);
+		p->setBrush(Qt::black);
+		p->drawPolygon(arrow, 6);
+		break;
+	}
+	case OddEvenStar: {
+		QPolygonF star;
+		for (int i = 0; i < 5; i++) {
+			const qreal a = (i * 144.0 + frame * 11.0) * M_PI / 180.0;
+			star << QPointF(48.0 + d * 0.3 + 40.0 * sin(a), 48.0 - 40.0 * cos(a));
+		}
+		p->setPen(QPen(Qt::black, 1.5));
+		p->setBrush(Qt::black);
+		p->drawPolygon(star, Qt::OddEvenFill);
+		break;
+	}
+	case Ellipse:
+		p->setPen(QPen(Qt::black, 2.25));
+		p->setBrush(Qt::gray);
+		p->drawEllipse(QRectF(d, 30.5 - d * 0.25, 50.5, 31.0));
+		break;
+	case ThickLine:
+		p->setPen(QPen(QBrush(Qt::black), 7.0, Qt::SolidLine, Qt::RoundCap));
+		p->drawLine(QPointF(d, 90.0), QPointF(90.0 - d, 5.5));
+		break;
+	case CosmeticLines:
+		p->setPen(QPen(Qt::black, 0));
+		for (int i = 0; i < 8; i++) {
+			p->drawLine(QPointF(d + i * 3.5, 2.0 + i * 11.0),
+			            QPointF(90.0 - i * 9.0, d + i * 5.25));
+		}
+		p->drawLine(QPoint(10, 50 + frame), QPoint(80, 50 + frame));
+		p->drawLine(QPoint(60 - frame, 3), QPoint(60 - frame, 93));
+		break;
+	case CurvedPath: {
+		QPainterPath path;
+		path.moveTo(d, 80.0);
+		path.cubicTo(QPointF(d + 20.0, -20.0), QPointF(60.0, 120.0), QPointF(95.5, d));
+		path.quadTo(QPointF(40.0, 40.0), QPointF(d, 80.0));
+		p->setPen(thick);
+		p->setBrush(Qt::black);
+		p->drawPath(path);
+		break;
+	}
+	case Polyline: {
+		const QPointF points[] = {
+			QPointF(5.0, d), QPointF(30.5, 80.0), QPointF(50.0, 10.25),
+			QPointF(70.0, 85.0), QPointF(92.0, d + 5.0)
+		};
+		p->setPen(QPen(QBrush(Qt::black), 2.5, Qt::SolidLine, Qt::FlatCap, Qt::RoundJoin));
+		p->drawPolyline(points, 5);
+		break;
+	}
+	case Points:
+		p->setPen(QPen(Qt::black, 0));
+		for (int i = 0; i < 20; i++) {
+			p->drawPoint(QPointF(d + i * 4.5, 3.0 + i * 4.75));
+		}
+		p->setPen(QPen(QBrush(Qt::black), 4.0, Qt::SolidLine, Qt::SquareCap));
+		for (int i = 0; i < 10; i++) {
+			p->drawPoint(QPoint(85 - i * 9, 10 + i * 8 + frame));
+		}
+		break;
+	case ClippedFill: {
+		QRegion clip(QRect(10, 10, 20, 60));
+		clip += QRect(40 + frame * 5, 30, 30, 20);
+		p->setClipRegion(clip);
+		p->rotate(10.0 * frame);
+		p->fillRect(QRectF(0.0, -10.0, 96.0, 110.0), Qt::black);
+		break;
+	}
+	}
+}
+
+class TestWatchPaintEngine : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void damage_data();
+	void damage();
+	void randomPolygons_data();
+	void randomPolygons();
+
+private:
+	/** Fails unless damage contains every pixel that differs between the frames. */
+	bool checkDamage(const QImage& before, const QImage& after, const QRegion& damage);
+};
+
+bool TestWatchPaintEngine::checkDamage(const QImage& before, const QImage& after, const QRegion& damage)
+{
+	for (int y = 0; y < after.height(); y++) {
+		for (int x = 0; x < after.width(); x++) {
+			if (before.pixel(x, y) != after.pixel(x, y) && !damage.contains(QPoint(x, y))) {
+				QTest::qFail(qPrintable(QString("Pixel %1,%2 changed but is not damaged")
+				                        .arg(x).arg(y)), __FILE__, __LINE__);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void TestWatchPaintEngine::damage_data()
+{
+	QTest::addColumn<int>("shape");
+	QTest::addColumn<QImage::Format>("format");
+	QTest::addColumn<int>("accumulator");
+	QTest::addColumn<WatchPaintEngine::DamageMode>("mode");
+	QTest::addColumn<bool>("antialias");
+
+	static const QImage::Format formats[] = {
+		QImage::Format_RGB32, QImage::Format_RGB16, QImage::Format_MonoLSB
+	};
+	static const char * const formatNames[] = { "rgb32", "rgb16", "mono" };
+	static const char * const accumulatorNames[] = { "region", "rows", "row spans" };
+	static const WatchPaintEngine::DamageMode modes[] = {
+		WatchPaintEngine::GeometricDamage,
+		WatchPaintEngine::PixelDiffDamage,
+		WatchPaintEngine::HybridDamage
+	};
+	static const char * const modeNames[] = { "geometric", "pixel diff", "hybrid" };
+
+	for (int shape = 0; shape < ShapeCount; shape++) {
+		for (int f = 0; f < 3; f++) {
+			for (int a = 0; a < 3; a++) {
+				for (int m = 0; m < 3; m++) {
+					for (int aa = 0; aa < 2; aa++) {
+						const QString name = QString("%1, %2, %3, %4%5")
+						        .arg(shapeNames[shape]).arg(formatNames[f])
+						        .arg(accumulatorNames[a]).arg(modeNames[m])
+						        .arg(aa ? ", antialiased" : "");
+						QTest::newRow(qPrintable(name))
+						        << shape << formats[f] << a << modes[m] << bool(aa);
+					}
+				}
+			}
+		}
+	}
+}
+
+void TestWatchPaintEngine::damage()
+{
+	QFETCH(int, shape);
+	QFETCH(QImage::Format, format);
+	QFETCH(int, accumulator);
+	QFETCH(WatchPaintEngine::DamageMode, mode);
+	QFETCH(bool, antialias);
+
+	Random random(shape + 1);
+	ImageDevice device(format, accumulator, mode);
+	device.fillNoise(&random);
+
+	// Several frames in a row, so that the snapshot of the previous one is reused.
+	for (int frame = 0; frame < 5; frame++) {
+		const QImage before = device.image.copy();
+
+		QPainter p(&device);
+		p.setRenderHint(QPainter::Antialiasing, antialias);
+		paintShape(&p, shape, frame);
+		p.end();
+
+		if (!checkDamage(before, device.image, device.damagedRegion())) {
+			qDebug() << "in frame" << frame << "with damage" << device.damagedRegion();
+			return;
+		}
+	}
+}
+
+void TestWatchPaintEngine::randomPolygons_data()
+{
+	QTest::addColumn<int>("accumulator");
+
+	QTest::newRow("region") << 0;
+	QTest::newRow("rows") << 1;
+	QTest::newRow("row spans") << 2;
+}
+
+void TestWatchPaintEngine::randomPolygons()
+{
+	QFETCH(int, accumulator);
+
+	Random random(0x5eed);
+	ImageDevice device(QImage::Format_RGB32, accumulator, WatchPaintEngine::GeometricDamage);
+	device.fillNoise(&random);
+
+	for (int round = 0; round < 500; round++) {
+		const QImage before = device.image.copy();
+
+		// Thin, degenerate, self intersecting and partially hidden polygons.
+		QPolygonF polygon;
+		const int n = random.bounded(3, 9);
+		for (int i = 0; i < n; i++) {
+			polygon << QPointF(random.real(-20.0, 116.0), random.real(-20.0, 116.0));
+		}
+		if (random.bounded(0, 3) == 0) {
+			polygon[1].setY(polygon[0].y()); // Horizontal edge
+		}
+
+		QPainter p(&device);
+		p.setRenderHint(QPainter::Antialiasing, random.bounded(0, 1));
+		if (random.bounded(0, 1)) {
+			p.translate(48.0, 48.0);
+			p.rotate(random.real(0.0, 360.0));
+			p.scale(random.real(0.5, 1.5), random.real(0.5, 1.5));
+			p.translate(-48.0, -48.0);
+		}
+		if (random.bounded(0, 1)) {
+			p.setPen(QPen(QColor::fromRgb(random.next()), random.real(0.0, 5.0)));
+		} else {
+			p.setPen(Qt::NoPen);
+		}
+		p.setBrush(QColor::fromRgb(random.next()));
+		p.drawPolygon(polygon, random.bounded(0, 1) ? Qt::OddEvenFill : Qt::WindingFill);
+		p.end();
+
+		if (!checkDamage(before, device.image, device.damagedRegion())) {
+			qDebug() << "in round" << round << "with polygon" << polygon;
+			return;
+		}
+	}
+}
+
+QTEST_APPLESS_MAIN(TestWatchPaintEngine)
+
+#include "tst_watchpaintengine.moc"
@@ -0,0 +1,12 @@
+TARGET = tst_watchpaintengine
+CONFIG += qtestlib testcase
+QT += gui
+
+SOURCES += tst_watchpaintengine.cpp \
+    ../../libsowatch/watchpaintengine.cpp \
+    ../../libsowatch/watchdamage.cpp
+
+HEADERS += ../../libsowatch/watchpaintengine.h \
+    ../../libsowatch/watchdamage.h
+
+INCLUDEPATH += $$PWD/../../libsowatch
@@ -0,0 +1,16 @@
+# The same tests as in watchpaintengine,
+# against the portable code instead of the SSE2/NEON one.
+TARGET = tst_watchpaintenginescalar
+CONFIG += qtestlib testcase
+QT += gui
+
+DEFINES += SOWATCH_NO_SIMD
+
+SOURCES += ../watchpaintengine/tst_watchpaintengine.cpp \
+    ../../libsowatch/watchpaintengine.cpp \
+    ../../libsowatch/watchdamage.cpp
+
+HEADERS += ../../libsowatch/watchpaintengine.h \
+    ../../libsowatch/watchdamage.h
+
+INCLUDEPATH += $$PWD/../../libsowatch